@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui webenginewidgets sql
+QT       += core gui webenginewidgets sql network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -37,6 +37,14 @@ SOURCES += \
     src/database.cpp \
     src/algorithms/featurematchingalgorithm.cpp \
     src/algorithms/surfalgorithm.cpp \
+    src/algorithms/stopfeatures.cpp \
+    src/algorithms/pageindex.cpp \
+    src/algorithms/changedetector.cpp \
+    src/os_specific/screenshotpool.cpp \
+    src/autotuner.cpp \
+    src/trace.cpp \
+    src/remoteanalyzer.cpp \
+    src/model/configuration.cpp \
     src/registrationtooldialog.cpp
 
 INCLUDEPATH += src/
@@ -53,11 +61,19 @@ HEADERS += \
     src/figurefindertask.h \
     src/database.h \
     src/os_specific/window.h \
+    src/os_specific/screenshotpool.h \
     src/algorithms/featurematchingalgorithm.h \
     src/algorithms/surfalgorithm.h \
+    src/algorithms/stopfeatures.h \
+    src/algorithms/pageindex.h \
+    src/algorithms/changedetector.h \
+    src/autotuner.h \
+    src/trace.h \
+    src/remoteanalyzer.h \
     src/registrationtooldialog.h \
     src/model/observable.h \
-    src/model/model.h
+    src/model/model.h \
+    src/model/configuration.h
 
 
 FORMS += \
@@ -66,14 +82,23 @@ FORMS += \
     forms/demodialog.ui
 
 
+# = Replay of a trace recorded with --record instead of the desktop (qmake CONFIG+=replay), e.g. to profile a session headlessly
+replay {
+    DEFINES += CHAMELEON_REPLAY
+    SOURCES += src/os_specific/replay/window.cpp
+    HEADERS += src/os_specific/replay/replay.h
+}
+
 windows {
     message("Needs to be configured")
 } else:mac {
     # = Code specific to macOs
-    OBJECTIVE_SOURCES += src/os_specific/macos/window.mm \
-                         src/os_specific/macos/accessibility.mm
+    !replay {
+        OBJECTIVE_SOURCES += src/os_specific/macos/window.mm \
+                             src/os_specific/macos/accessibility.mm
 
-    HEADERS += src/os_specific/macos/accessibility.h
+        HEADERS += src/os_specific/macos/accessibility.h
+    }
 
     LIBS += -F/System/Library/PrivateFrameworks \
         -framework MultitouchSupport -v \
@@ -100,6 +125,28 @@ windows {
     }
 
 } else:linux-*  {
+    # = X11 backend
+    !replay {
+        QT += dbus
+
+        SOURCES += src/os_specific/linux/window.cpp \
+                   src/os_specific/linux/accessibility.cpp \
+                   src/os_specific/linux/atspilistener.cpp \
+                   src/os_specific/linux/files.cpp
+
+        HEADERS += src/os_specific/linux/accessibility.h \
+                   src/os_specific/linux/atspilistener.h \
+                   src/os_specific/linux/files.h
+
+        LIBS += -lX11 -lXext -lXi -lXdamage
+    }
+
+    # = Add OpenCV4 to path
+    system(pkg-config --exists opencv4) {
+      QMAKE_CXXFLAGS += $$system("pkg-config --cflags opencv4")
+      LIBS += $$system("pkg-config --libs-only-L opencv4")
+      message("OpenCV4 found")
+    }
 }
 
 # OpenCV
@@ -0,0 +1,128 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include "changedetector.h"
+#include <string.h>
+
+using namespace cv;
+
+// Constants and round of xxHash64, with 4 independent accumulators so that they can be computed in parallel by the CPU
+// Collisions only matter if they happen on the same tile between two consecutive frames, so a 64 bits hash is plenty
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t lane) {
+    return rotl(acc + lane * PRIME2, 31) * PRIME1;
+}
+
+static inline uint64_t readLane(const uchar* data) {
+    uint64_t lane;
+    memcpy(&lane, data, sizeof(lane));
+    return lane;
+}
+
+// Hash the *tile* of *frame*, row after row
+static uint64_t hashTile(const Mat& frame, Rect tile) {
+    uint64_t acc[4] = {PRIME1 + PRIME2, PRIME2, 0, PRIME1};
+    size_t length = tile.width * frame.elemSize();
+
+    for (int y = tile.y; y < tile.br().y; ++y) {
+        const uchar* row = frame.ptr<uchar>(y) + tile.x * frame.elemSize();
+        size_t i = 0;
+        for (; i + 32 <= length; i += 32) {
+            acc[0] = round64(acc[0], readLane(row + i));
+            acc[1] = round64(acc[1], readLane(row + i + 8));
+            acc[2] = round64(acc[2], readLane(row + i + 16));
+            acc[3] = round64(acc[3], readLane(row + i + 24));
+        }
+        for (; i + 8 <= length; i += 8) {
+            acc[0] = round64(acc[0], readLane(row + i));
+        }
+        for (; i < length; ++i) {
+            acc[1] = round64(acc[1], row[i]);
+        }
+    }
+
+    uint64_t hash = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+ChangeDetector::ChangeDetector(int tileSize) :
+    tileSize(tileSize), frameType(-1) {
+}
+
+// Hash the tiles of *frame* and compare them with the ones of the previous frame
+// Returns the rectangles that changed (horizontally adjacent dirty tiles are merged), the whole frame if its size or type changed
+std::vector<Rect> ChangeDetector::update(Mat frame) {
+    std::vector<Rect> dirtyRects;
+    if (frame.empty()) {
+        reset();
+        return dirtyRects;
+    }
+
+    int nbTilesX = (frame.cols + tileSize - 1) / tileSize;
+    int nbTilesY = (frame.rows + tileSize - 1) / tileSize;
+    bool comparable = frame.size() == frameSize && frame.type() == frameType && (int) hashes.size() == nbTilesX * nbTilesY;
+
+    std::vector<uint64_t> newHashes(nbTilesX * nbTilesY);
+    Rect frameRect(0, 0, frame.cols, frame.rows);
+    for (int ty = 0; ty < nbTilesY; ++ty) {
+        Rect run;
+        for (int tx = 0; tx < nbTilesX; ++tx) {
+            Rect tile = Rect(tx * tileSize, ty * tileSize, tileSize, tileSize) & frameRect;
+            uint64_t hash = hashTile(frame, tile);
+            newHashes[ty * nbTilesX + tx] = hash;
+
+            if (comparable && hash == hashes[ty * nbTilesX + tx]) {
+                if (!run.empty()) {
+                    dirtyRects.push_back(run);
+                    run = Rect();
+                }
+            } else {
+                run = run.empty() ? tile : (run | tile);
+            }
+        }
+        if (!run.empty()) {
+            dirtyRects.push_back(run);
+        }
+    }
+
+    if (!comparable) {
+        dirtyRects.assign(1, frameRect);
+    }
+
+    hashes.swap(newHashes);
+    frameSize = frame.size();
+    frameType = frame.type();
+    return dirtyRects;
+}
+
+void ChangeDetector::reset() {
+    hashes.clear();
+    frameSize = Size();
+    frameType = -1;
+}
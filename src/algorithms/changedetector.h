@@ -0,0 +1,42 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#ifndef CHANGEDETECTOR_H
+#define CHANGEDETECTOR_H
+
+#include <vector>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+
+// Detects which parts of a window changed between two frames
+// Only a hash per tile of the previous frame is kept, not its pixels
+class ChangeDetector
+{
+public:
+    ChangeDetector(int tileSize = 64);
+    std::vector<cv::Rect> update(cv::Mat frame);
+    void reset();
+    inline bool hasFrame() {return !hashes.empty();}
+
+private:
+    int tileSize;
+    cv::Size frameSize;
+    int frameType;
+    std::vector<uint64_t> hashes; // Row-major, one per tile
+};
+
+#endif // CHANGEDETECTOR_H
@@ -25,22 +25,278 @@ FeatureMatchingAlgorithm::FeatureMatchingAlgorithm() {
     this->name = "FeatureMatchingAlgorithm";
     nbAssociationMax = -1;
     distanceThreshold = -1;
+    nbTiles = 1;
+    tileOverlap = 64;
+    minInliers = 12;
+    minConsensus = 0.6;
 }
 
-std::vector<KeyPoint> FeatureMatchingAlgorithm::detect(Mat image) {
+// Converts an RGB(A) image to the luminance the detector computes itself from color images
+// OpenCV takes them for BGR(A), so red and blue weights are swapped compared to the real luminance. Grayscale captures must use the same
+// weights, otherwise colored figures (whose stored features were computed from their RGBA image) would not give the same keypoints
+Mat FeatureMatchingAlgorithm::toGrayscale(Mat image) {
+    if (image.channels() == 1) {
+        return image;
+    }
+
+    Mat gray;
+    cvtColor(image, gray, image.channels() == 4 ? COLOR_BGRA2GRAY : COLOR_BGR2GRAY);
+    return gray;
+}
+
+// Keypoints are only looked for where *mask* is non zero (or everywhere if *mask* is empty)
+std::vector<KeyPoint> FeatureMatchingAlgorithm::detect(Mat image, Mat mask) {
     std::vector<KeyPoint> keypoints;
     
-    detector->detect(image, keypoints);
+    detector->detect(image, keypoints, mask);
     
     return keypoints;
 }
 
-Mat FeatureMatchingAlgorithm::compute(Mat image, std::vector<KeyPoint> keypoints) {
+// Keypoints that cannot be described are removed from *keypoints*
+Mat FeatureMatchingAlgorithm::compute(Mat image, std::vector<KeyPoint>& keypoints) {
     Mat descriptors;
     descriptor->compute(image, keypoints, descriptors);
     return descriptors;
 }
 
+// Detect and describe (unless *describe* is false) the keypoints of *image*, splitting it in *nbTiles* tiles analyzed in parallel
+void FeatureMatchingAlgorithm::detectAndCompute(Mat image, std::vector<KeyPoint>& keypoints, Mat& descriptors, Mat mask, bool describe) {
+    keypoints.clear();
+    descriptors = Mat();
+
+    if (!mask.empty() && countNonZero(mask) == 0) {
+        return;
+    }
+
+    // Small images are not worth the split
+    if (nbTiles <= 1 || image.cols * image.rows < 4 * tileOverlap * tileOverlap * nbTiles) {
+        keypoints = detect(image, mask);
+        if (describe) {
+            descriptor->compute(image, keypoints, descriptors);
+        }
+        return;
+    }
+
+    // Split along the longest side first so that tiles stay as square as possible
+    int cols = qMax(1, qRound(std::sqrt(nbTiles * (double) image.cols / image.rows)));
+    int rows = qMax(1, (nbTiles + cols - 1) / cols);
+    int tileWidth = (image.cols + cols - 1) / cols;
+    int tileHeight = (image.rows + rows - 1) / rows;
+
+    std::vector<Rect> tiles;
+    for (int i = 0; i < rows * cols; ++i) {
+        tiles.push_back(Rect((i % cols) * tileWidth, (i / cols) * tileHeight, tileWidth, tileHeight));
+    }
+
+    detectAndComputeInRegions(image, tiles, keypoints, descriptors, mask, describe);
+}
+
+// Detect and describe the keypoints of *image* lying in *regions*, each region being analyzed in parallel
+// Each region is analyzed with a margin of *tileOverlap* pixels so that the keypoints near its borders are identical to the ones found on the full image
+// A keypoint is only kept by the region that contains it, so regions must not overlap
+void FeatureMatchingAlgorithm::detectAndComputeInRegions(Mat image, std::vector<Rect> regions, std::vector<KeyPoint>& keypoints, Mat& descriptors, Mat mask, bool describe) {
+    keypoints.clear();
+    descriptors = Mat();
+
+    Rect imageRect(0, 0, image.cols, image.rows);
+    std::vector<std::vector<KeyPoint>> regionsKeypoints(regions.size());
+    std::vector<Mat> regionsDescriptors(regions.size());
+
+    parallel_for_(Range(0, (int) regions.size()), [&](const Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            Rect core = regions[i] & imageRect;
+            if (core.empty()) {
+                continue;
+            }
+
+            Rect tile = Rect(core.x - tileOverlap, core.y - tileOverlap, core.width + 2 * tileOverlap, core.height + 2 * tileOverlap) & imageRect;
+            Mat tileImage = image(tile);
+
+            std::vector<KeyPoint> tileKeypoints;
+            detector->detect(tileImage, tileKeypoints, mask.empty() ? Mat() : mask(tile));
+
+            std::vector<KeyPoint> coreKeypoints;
+            for (auto keypoint : tileKeypoints) {
+                if (core.contains(Point2f(keypoint.pt.x + tile.x, keypoint.pt.y + tile.y))) {
+                    coreKeypoints.push_back(keypoint);
+                }
+            }
+
+            if (coreKeypoints.empty()) {
+                continue;
+            }
+
+            // The descriptor may drop keypoints, so the offset is only applied to the ones it kept
+            if (describe) {
+                descriptor->compute(tileImage, coreKeypoints, regionsDescriptors[i]);
+            }
+            for (auto& keypoint : coreKeypoints) {
+                keypoint.pt.x += tile.x;
+                keypoint.pt.y += tile.y;
+            }
+            regionsKeypoints[i] = coreKeypoints;
+        }
+    });
+
+    std::vector<Mat> nonEmptyDescriptors;
+    for (int i = 0; i < (int) regions.size(); ++i) {
+        if (!regionsKeypoints[i].empty()) {
+            keypoints.insert(keypoints.end(), regionsKeypoints[i].begin(), regionsKeypoints[i].end());
+            if (describe) {
+                nonEmptyDescriptors.push_back(regionsDescriptors[i]);
+            }
+        }
+    }
+
+    if (!nonEmptyDescriptors.empty()) {
+        vconcat(nonEmptyDescriptors, descriptors);
+    }
+}
+
+// Select at most *maxKeypoints* keypoints among the *keypoints* detected in *image*, favoring stable and well-spread ones
+// Stability is measured by detecting the keypoints again on rescaled and blurred versions of the image (as the figure will be seen on screen),
+// and the selection uses adaptive non-maximal suppression so that the kept keypoints cover the whole image
+std::vector<KeyPoint> FeatureMatchingAlgorithm::selectStableKeypoints(Mat image, std::vector<KeyPoint> keypoints, int maxKeypoints) {
+    if (maxKeypoints <= 0 || (int) keypoints.size() <= maxKeypoints) {
+        return keypoints;
+    }
+
+    const double scales[] = {0.75, 1.25, 1, 1};
+    const double blurs[] = {0, 0, 1, 2};
+    const int nbTransforms = 4;
+    std::vector<int> stability(keypoints.size(), 0);
+
+    for (int t = 0; t < nbTransforms; ++t) {
+        Mat transformed;
+        resize(image, transformed, Size(), scales[t], scales[t], INTER_AREA);
+        if (blurs[t] > 0) {
+            GaussianBlur(transformed, transformed, Size(), blurs[t]);
+        }
+
+        std::vector<KeyPoint> transformedKeypoints;
+        detector->detect(transformed, transformedKeypoints);
+
+        // A keypoint is stable if it is found again at the same place, with a similar size
+        double tolerance = 3 / qMin(scales[t], 1.0);
+        for (int i = 0; i < (int) keypoints.size(); ++i) {
+            for (auto& transformedKeypoint : transformedKeypoints) {
+                Point2f pt = transformedKeypoint.pt / scales[t];
+                double sizeRatio = transformedKeypoint.size / scales[t] / keypoints[i].size;
+                if (norm(pt - keypoints[i].pt) <= tolerance && sizeRatio > 0.7 && sizeRatio < 1.4) {
+                    stability[i]++;
+                    break;
+                }
+            }
+        }
+    }
+
+    std::vector<double> strength(keypoints.size());
+    for (int i = 0; i < (int) keypoints.size(); ++i) {
+        strength[i] = keypoints[i].response * (1 + stability[i]);
+    }
+
+    // Suppression radius: distance to the closest keypoint that is significantly stronger
+    std::vector<std::pair<double, int>> radiuses;
+    for (int i = 0; i < (int) keypoints.size(); ++i) {
+        double radius = std::numeric_limits<double>::max();
+        for (int j = 0; j < (int) keypoints.size(); ++j) {
+            if (0.9 * strength[j] > strength[i]) {
+                radius = qMin(radius, (double) norm(keypoints[j].pt - keypoints[i].pt));
+            }
+        }
+        radiuses.push_back(std::make_pair(radius, i));
+    }
+
+    std::sort(radiuses.begin(), radiuses.end(), [](const std::pair<double, int>& a, const std::pair<double, int>& b) {
+        return a.first > b.first;
+    });
+
+    std::vector<KeyPoint> selected;
+    for (int i = 0; i < maxKeypoints; ++i) {
+        selected.push_back(keypoints[radiuses[i].second]);
+    }
+
+    return selected;
+}
+
+// Find the regions of the scene where the layout of the keypoints looks like the one of an *imgWidth*x*imgHeight* object
+// Only positions and sizes are used (no descriptors): each pair of object/scene keypoints of similar size votes for
+// the position (and scale) of the object's origin in the scene, and the regions are the ones of the most voted positions
+std::vector<Rect> FeatureMatchingAlgorithm::findCandidateRegions(int imgWidth, int imgHeight, std::vector<KeyPoint> objectKeypoints, std::vector<KeyPoint> sceneKeypoints, Size sceneSize) {
+    const int cellSize = 24;
+    const int nbScales = 5; // Scale ratios between 1/2 and 2 by steps of half an octave
+    const int maxObjectKeypoints = 150;
+    const int minVotes = 8;
+    std::vector<Rect> regions;
+
+    if (objectKeypoints.empty() || sceneKeypoints.empty()) {
+        return regions;
+    }
+
+    // The strongest keypoints are the most likely to be detected again
+    std::sort(objectKeypoints.begin(), objectKeypoints.end(), [](const KeyPoint& a, const KeyPoint& b) {
+        return a.response > b.response;
+    });
+    if ((int) objectKeypoints.size() > maxObjectKeypoints) {
+        objectKeypoints.resize(maxObjectKeypoints);
+    }
+
+    // The object's origin can be outside the scene if the object is only partly visible
+    int marginX = 2 * imgWidth;
+    int marginY = 2 * imgHeight;
+    int gridWidth = (sceneSize.width + marginX) / cellSize + 1;
+    int gridHeight = (sceneSize.height + marginY) / cellSize + 1;
+    std::vector<int> votes(nbScales * gridWidth * gridHeight, 0);
+    int nbVotes = 0;
+
+    for (auto& sceneKeypoint : sceneKeypoints) {
+        for (auto& objectKeypoint : objectKeypoints) {
+            double ratio = sceneKeypoint.size / objectKeypoint.size;
+            int scale = qRound(2 * std::log2(ratio)) + nbScales / 2;
+            if (scale < 0 || scale >= nbScales) {
+                continue;
+            }
+
+            int cellX = (sceneKeypoint.pt.x - ratio * objectKeypoint.pt.x + marginX) / cellSize;
+            int cellY = (sceneKeypoint.pt.y - ratio * objectKeypoint.pt.y + marginY) / cellSize;
+            if (cellX < 0 || cellX >= gridWidth || cellY < 0 || cellY >= gridHeight) {
+                continue;
+            }
+
+            votes[(scale * gridHeight + cellY) * gridWidth + cellX]++;
+            nbVotes++;
+        }
+    }
+
+    // Most cells only get the votes of unrelated content (e.g. text), so a candidate needs a lot more than the average
+    int nbVotedCells = (int) std::count_if(votes.begin(), votes.end(), [](int v) {return v > 0;});
+    double threshold = qMax((double) minVotes, 0.15 * objectKeypoints.size());
+    if (nbVotedCells > 0) {
+        threshold = qMax(threshold, 3.0 * nbVotes / nbVotedCells);
+    }
+
+    Rect sceneRect(0, 0, sceneSize.width, sceneSize.height);
+    for (int scale = 0; scale < nbScales; ++scale) {
+        double ratio = std::pow(2.0, (scale - nbScales / 2) / 2.0);
+        for (int cellY = 0; cellY < gridHeight; ++cellY) {
+            for (int cellX = 0; cellX < gridWidth; ++cellX) {
+                if (votes[(scale * gridHeight + cellY) * gridWidth + cellX] >= threshold) {
+                    // Add a cell around the object to account for the quantization of the votes
+                    Rect region(cellX * cellSize - marginX - cellSize, cellY * cellSize - marginY - cellSize,
+                                ratio * imgWidth + 3 * cellSize, ratio * imgHeight + 3 * cellSize);
+                    region &= sceneRect;
+                    if (!region.empty()) {
+                        regions.push_back(region);
+                    }
+                }
+            }
+        }
+    }
+
+    return regions;
+}
+
 bool matchComparison(DMatch a, DMatch b) {
     return a.distance < b.distance;
 }
@@ -71,7 +327,8 @@ std::vector<DMatch> FeatureMatchingAlgorithm::match(Mat objectDescriptors, Mat s
     return goodMatches;
 }
 
-Rect FeatureMatchingAlgorithm::computeObjectRect(int imgWidth, int imgHeight, std::vector<DMatch> matches, std::vector<KeyPoint> objectKeypoints, std::vector<KeyPoint> sceneKeypoints) {
+// *stats*, if not NULL, is filled with the details on the inliers of the estimation
+Rect FeatureMatchingAlgorithm::computeObjectRect(int imgWidth, int imgHeight, std::vector<DMatch> matches, std::vector<KeyPoint> objectKeypoints, std::vector<KeyPoint> sceneKeypoints, MatchingStats* stats) {
     std::vector<Point2f> obj;
     std::vector<Point2f> scen;
 
@@ -84,9 +341,31 @@ Rect FeatureMatchingAlgorithm::computeObjectRect(int imgWidth, int imgHeight, st
         scen.push_back(sceneKeypoints[matches[i].trainIdx].pt);
     }
     
-    Mat H = findHomography(obj, scen, RANSAC);
+    Mat inliersMask;
+    Mat H = findHomography(obj, scen, RANSAC, 3, inliersMask);
+    fillStats(matches, inliersMask, stats);
     
-    if (H.empty()) {
+    return projectObjectRect(imgWidth, imgHeight, H);
+}
+
+void FeatureMatchingAlgorithm::fillStats(std::vector<DMatch>& matches, Mat inliersMask, MatchingStats* stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    stats->inlierDistances.clear();
+    stats->lastInlierRank = -1;
+    for (int i = 0; i < inliersMask.rows; ++i) {
+        if (inliersMask.at<uchar>(i)) {
+            stats->inlierDistances.push_back(matches[i].distance);
+            stats->lastInlierRank = i;
+        }
+    }
+}
+
+// Compute the rectangle of an *imgWidth*x*imgHeight* object in the scene using the object->scene *homography*
+Rect FeatureMatchingAlgorithm::projectObjectRect(int imgWidth, int imgHeight, Mat homography) {
+    if (homography.empty()) {
         return Rect(-1, -1, -1, -1);
     }
 
@@ -95,7 +374,7 @@ Rect FeatureMatchingAlgorithm::computeObjectRect(int imgWidth, int imgHeight, st
     objCorners[2] = Point2f(imgWidth, imgHeight); objCorners[3] = Point2f(0, imgHeight);
     std::vector<Point2f> sceneCorners(4);
     
-    perspectiveTransform(objCorners, sceneCorners, H);
+    perspectiveTransform(objCorners, sceneCorners, homography);
     
     int x = (sceneCorners[0]).x;
     int y = (sceneCorners[0]).y;
@@ -105,6 +384,82 @@ Rect FeatureMatchingAlgorithm::computeObjectRect(int imgWidth, int imgHeight, st
     return Rect(x, y, width, height);
 }
 
+// Same as match() followed by computeObjectRect(), but the object descriptors are matched by batches of increasing size, strongest keypoints first
+// After each batch, a placement is estimated from the best matches so far and accepted as soon as
+// at least *minInliers* matches agree on it and they represent at least *minConsensus* of the matches used
+// Clear matches therefore stop early, and only hard cases pay the cost of matching all the descriptors
+Rect FeatureMatchingAlgorithm::matchProgressively(int imgWidth, int imgHeight, Mat objectDescriptors, std::vector<KeyPoint> objectKeypoints, Mat sceneDescriptors, std::vector<KeyPoint> sceneKeypoints, MatchingStats* stats) {
+    Rect rect(-1, -1, -1, -1);
+
+    if (objectDescriptors.empty() || sceneDescriptors.empty()) {
+        return rect;
+    }
+
+    std::vector<int> order(objectDescriptors.rows);
+    for (int i = 0; i < (int) order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return objectKeypoints[a].response > objectKeypoints[b].response;
+    });
+
+    BFMatcher matcher(objectDescriptors.type() != CV_32F ? NORM_HAMMING : NORM_L2);
+    std::vector<DMatch> matches;
+    int nbMatched = 0;
+    int batchSize = qMax(minInliers, 8) * 2;
+
+    while (nbMatched < (int) order.size()) {
+        int batchEnd = qMin(nbMatched + batchSize, (int) order.size());
+        Mat batchDescriptors;
+        for (int i = nbMatched; i < batchEnd; ++i) {
+            batchDescriptors.push_back(objectDescriptors.row(order[i]));
+        }
+
+        std::vector<DMatch> batchMatches;
+        matcher.match(batchDescriptors, sceneDescriptors, batchMatches);
+        for (auto match : batchMatches) {
+            if (distanceThreshold <= 0 || match.distance < distanceThreshold) {
+                match.queryIdx = order[nbMatched + match.queryIdx];
+                matches.push_back(match);
+            }
+        }
+
+        nbMatched = batchEnd;
+        batchSize *= 2;
+
+        std::sort(matches.begin(), matches.end(), matchComparison);
+        int nbUsed = nbAssociationMax > 0 ? qMin((int) matches.size(), nbAssociationMax) : (int) matches.size();
+
+        if (nbUsed <= 4) {
+            continue;
+        }
+
+        std::vector<Point2f> obj;
+        std::vector<Point2f> scen;
+        for (int i = 0; i < nbUsed; i++) {
+            obj.push_back(objectKeypoints[matches[i].queryIdx].pt);
+            scen.push_back(sceneKeypoints[matches[i].trainIdx].pt);
+        }
+
+        Mat inliersMask;
+        Mat H = findHomography(obj, scen, RANSAC, 3, inliersMask);
+
+        // Always keep the latest estimation, which is the one of the full match set once all descriptors are matched
+        rect = projectObjectRect(imgWidth, imgHeight, H);
+        fillStats(matches, inliersMask, stats);
+        if (H.empty()) {
+            continue;
+        }
+
+        int nbInliers = countNonZero(inliersMask);
+        if (nbInliers >= minInliers && nbInliers >= minConsensus * nbUsed) {
+            break;
+        }
+    }
+
+    return rect;
+}
+
 QString FeatureMatchingAlgorithm::getDescription() {
     qint64 detectTime = objectDetectTime + sceneDetectTime;
     qint64 computeTime = objectComputeTime + sceneComputeTime;
@@ -27,19 +27,36 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 
 using namespace cv;
 
+// Details on the matches that located an object, used to calibrate the matching thresholds
+struct MatchingStats {
+    std::vector<float> inlierDistances;
+    int lastInlierRank; // Rank (by increasing distance) of the worst inlier among the matches used
+};
+
 class FeatureMatchingAlgorithm
 {
 public:
     FeatureMatchingAlgorithm();
     
-    std::vector<KeyPoint> detect(Mat image);
-    Mat compute(Mat image, std::vector<KeyPoint> keypoints);
+    std::vector<KeyPoint> detect(Mat image, Mat mask = Mat());
+    Mat compute(Mat image, std::vector<KeyPoint>& keypoints);
+    void detectAndCompute(Mat image, std::vector<KeyPoint>& keypoints, Mat& descriptors, Mat mask = Mat(), bool describe = true);
+    void detectAndComputeInRegions(Mat image, std::vector<Rect> regions, std::vector<KeyPoint>& keypoints, Mat& descriptors, Mat mask = Mat(), bool describe = true);
+    std::vector<KeyPoint> selectStableKeypoints(Mat image, std::vector<KeyPoint> keypoints, int maxKeypoints);
+    std::vector<Rect> findCandidateRegions(int imgWidth, int imgHeight, std::vector<KeyPoint> objectKeypoints, std::vector<KeyPoint> sceneKeypoints, Size sceneSize);
     std::vector<DMatch> match(Mat objectDescriptors, Mat sceneDescriptors);
-    Rect computeObjectRect(int imgWidth, int imgHeight, std::vector<DMatch> matches, std::vector<KeyPoint> objectKeypoints, std::vector<KeyPoint> sceneKeypoints);
+    Rect computeObjectRect(int imgWidth, int imgHeight, std::vector<DMatch> matches, std::vector<KeyPoint> objectKeypoints, std::vector<KeyPoint> sceneKeypoints, MatchingStats* stats = NULL);
+    Rect matchProgressively(int imgWidth, int imgHeight, Mat objectDescriptors, std::vector<KeyPoint> objectKeypoints, Mat sceneDescriptors, std::vector<KeyPoint> sceneKeypoints, MatchingStats* stats = NULL);
     QString getDescription();
+    static Mat toGrayscale(Mat image);
+    inline QString getName() {return name;} // Identifies the algorithm and its parameters
 
     void setNbAssociationMax(int nbAssociationMax) {this->nbAssociationMax = nbAssociationMax;}
     void setDistanceThreshold(double distanceThreshold) {this->distanceThreshold = distanceThreshold;}
+    void setNbTiles(int nbTiles) {this->nbTiles = nbTiles;}
+    int getNbTiles() {return nbTiles;}
+    int getTileOverlap() {return tileOverlap;}
+    void setProgressiveAcceptance(int minInliers, double minConsensus) {this->minInliers = minInliers; this->minConsensus = minConsensus;}
     
 protected:
     Ptr<FeatureDetector> detector;
@@ -51,10 +68,17 @@ protected:
     qint64 matchTime;
     qint64 computeRectTime;
     QString name;
+    int tileOverlap; // Must be at least the radius of the biggest feature (detection + description) in pixels
 
 private:
     int nbAssociationMax;
     double distanceThreshold;
+    int nbTiles;
+    int minInliers;
+    double minConsensus;
+
+    Rect projectObjectRect(int imgWidth, int imgHeight, Mat homography);
+    void fillStats(std::vector<DMatch>& matches, Mat inliersMask, MatchingStats* stats);
     
 };
 
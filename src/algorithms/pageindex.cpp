@@ -0,0 +1,118 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include "pageindex.h"
+
+using namespace cv;
+
+// Size of the tiny image and of the horizontal profile composing the descriptor
+#define TINY_IMAGE_SIZE 16
+#define PROFILE_SIZE 64
+
+// Zero-mean and unit norm, so that the dot product of two parts is their normalized cross-correlation
+static Mat normalizePart(Mat part) {
+    part = part - mean(part)[0];
+    double length = norm(part, NORM_L2);
+    return length > 1e-6 ? part / length : Mat::zeros(part.size(), part.type());
+}
+
+PageIndex::PageIndex() {
+}
+
+// The descriptor is made of a tiny version of the page and of its mean intensity per column
+// The column profile captures the layout of the document (margins, text columns), which barely changes when scrolling
+// Both parts are weighted so that the descriptor has a unit norm (the dot product of two descriptors is in [-1, 1])
+Mat PageIndex::describe(Mat page) {
+    if (page.empty()) {
+        return Mat();
+    }
+
+    Mat gray;
+    if (page.channels() == 1) {
+        gray = page;
+    } else {
+        cvtColor(page, gray, page.channels() == 4 ? COLOR_RGBA2GRAY : COLOR_RGB2GRAY);
+    }
+
+    Mat tiny;
+    resize(gray, tiny, Size(TINY_IMAGE_SIZE, TINY_IMAGE_SIZE), 0, 0, INTER_AREA);
+    tiny.convertTo(tiny, CV_32F);
+
+    Mat profile;
+    reduce(gray, profile, 0, REDUCE_AVG, CV_32F);
+    resize(profile, profile, Size(PROFILE_SIZE, 1), 0, 0, INTER_AREA);
+
+    Mat tinyPart = normalizePart(tiny.reshape(1, 1)) * M_SQRT1_2;
+    Mat profilePart = normalizePart(profile) * M_SQRT1_2;
+
+    Mat descriptor;
+    hconcat(tinyPart, profilePart, descriptor);
+    return descriptor;
+}
+
+void PageIndex::add(int figureId, QString path, Mat descriptor) {
+    if (descriptor.empty()) {
+        return;
+    }
+
+    mutex.lock();
+    descriptors.push_back(descriptor);
+    figureIds.append(figureId);
+    paths.append(path);
+    mutex.unlock();
+}
+
+void PageIndex::remove(int figureId) {
+    mutex.lock();
+    int i = figureIds.indexOf(figureId);
+    if (i >= 0) {
+        Mat remaining;
+        for (int row = 0; row < descriptors.rows; ++row) {
+            if (row != i) {
+                remaining.push_back(descriptors.row(row));
+            }
+        }
+        descriptors = remaining;
+        figureIds.removeAt(i);
+        paths.removeAt(i);
+    }
+    mutex.unlock();
+}
+
+// Returns the path of the document whose page is the most similar to *descriptor* (empty if none is similar enough)
+// A single matrix product with all the pages, so it is cheap enough to be done each time a window gets the focus
+QString PageIndex::query(Mat descriptor, double minSimilarity, double* similarity) {
+    QString path;
+
+    mutex.lock();
+    if (!descriptor.empty() && !descriptors.empty() && descriptor.cols == descriptors.cols) {
+        Mat similarities = descriptors * descriptor.t();
+        double maxSimilarity;
+        Point maxLoc;
+        minMaxLoc(similarities, NULL, &maxSimilarity, NULL, &maxLoc);
+
+        if (similarity != NULL) {
+            *similarity = maxSimilarity;
+        }
+        if (maxSimilarity >= minSimilarity) {
+            path = paths.at(maxLoc.y);
+        }
+    }
+    mutex.unlock();
+
+    return path;
+}
@@ -0,0 +1,45 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#ifndef PAGEINDEX_H
+#define PAGEINDEX_H
+
+#include <QString>
+#include <QList>
+#include <QMutex>
+#include <opencv2/opencv.hpp>
+
+// Compact global descriptors of the pages on which figures were registered
+// Used to find out which document a window shows when its file path is unknown
+class PageIndex
+{
+public:
+    PageIndex();
+    static cv::Mat describe(cv::Mat page);
+    void add(int figureId, QString path, cv::Mat descriptor);
+    void remove(int figureId);
+    QString query(cv::Mat descriptor, double minSimilarity = 0.95, double* similarity = NULL);
+    inline bool isEmpty() {return figureIds.isEmpty();}
+
+private:
+    QMutex mutex;
+    cv::Mat descriptors; // One row per page
+    QList<int> figureIds;
+    QList<QString> paths;
+};
+
+#endif // PAGEINDEX_H
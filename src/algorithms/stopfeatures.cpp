@@ -0,0 +1,132 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include "stopfeatures.h"
+#include <QDebug>
+
+using namespace cv;
+
+StopFeatures::StopFeatures() {
+}
+
+// Cluster the descriptors found on plain document pages into *nbWords* words
+// Only the tightest half of the words is kept: these are the patterns repeated all over documents (e.g. glyphs)
+// Each word's radius is the median distance of its descriptors to its center
+void StopFeatures::build(Mat pagesDescriptors, int nbWords) {
+    words = Mat();
+    radiuses.clear();
+
+    // Clustering only makes sense for float descriptors
+    if (pagesDescriptors.type() != CV_32F || pagesDescriptors.rows < nbWords) {
+        return;
+    }
+
+    Mat labels;
+    Mat centers;
+    kmeans(pagesDescriptors, nbWords, labels, TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 20, 0.01), 3, KMEANS_PP_CENTERS, centers);
+
+    std::vector<std::vector<float>> distances(nbWords);
+    for (int i = 0; i < pagesDescriptors.rows; ++i) {
+        int word = labels.at<int>(i);
+        distances[word].push_back(norm(pagesDescriptors.row(i), centers.row(word), NORM_L2));
+    }
+
+    std::vector<float> medians(nbWords, std::numeric_limits<float>::max());
+    for (int word = 0; word < nbWords; ++word) {
+        if (!distances[word].empty()) {
+            std::nth_element(distances[word].begin(), distances[word].begin() + distances[word].size() / 2, distances[word].end());
+            medians[word] = distances[word][distances[word].size() / 2];
+        }
+    }
+
+    std::vector<float> sortedMedians = medians;
+    std::sort(sortedMedians.begin(), sortedMedians.end());
+    float maxRadius = sortedMedians[nbWords / 2];
+
+    for (int word = 0; word < nbWords; ++word) {
+        if (medians[word] <= maxRadius) {
+            words.push_back(centers.row(word));
+            radiuses.push_back(medians[word]);
+        }
+    }
+
+    qDebug() << "Stop-features built with" << words.rows << "words from" << pagesDescriptors.rows << "descriptors";
+}
+
+bool StopFeatures::load(QString path) {
+    FileStorage file(path.toStdString(), FileStorage::READ);
+    if (!file.isOpened()) {
+        return false;
+    }
+
+    file["words"] >> words;
+    file["radiuses"] >> radiuses;
+    return words.rows == (int) radiuses.size();
+}
+
+bool StopFeatures::save(QString path) {
+    FileStorage file(path.toStdString(), FileStorage::WRITE);
+    if (!file.isOpened()) {
+        return false;
+    }
+
+    file << "words" << words;
+    file << "radiuses" << radiuses;
+    return true;
+}
+
+// Remove the keypoints (and their descriptors) lying within the radius of a stop word, the closest ones first
+// At least *minKeypoints* keypoints are kept so that the figure can still be found
+// Returns the number of keypoints removed
+int StopFeatures::prune(std::vector<KeyPoint>& keypoints, Mat& descriptors, int minKeypoints) {
+    if (isEmpty() || descriptors.type() != words.type() || descriptors.cols != words.cols) {
+        return 0;
+    }
+
+    BFMatcher matcher(NORM_L2);
+    std::vector<DMatch> matches;
+    matcher.match(descriptors, words, matches);
+
+    // Closeness of each descriptor to its nearest stop word, relative to the word's radius
+    std::vector<std::pair<float, int>> stopKeypoints;
+    for (auto& match : matches) {
+        float closeness = match.distance / radiuses[match.trainIdx];
+        if (closeness < 1) {
+            stopKeypoints.push_back(std::make_pair(closeness, match.queryIdx));
+        }
+    }
+    std::sort(stopKeypoints.begin(), stopKeypoints.end());
+
+    int nbRemovable = qMax(0, qMin((int) stopKeypoints.size(), (int) keypoints.size() - minKeypoints));
+    std::vector<bool> removed(keypoints.size(), false);
+    for (int i = 0; i < nbRemovable; ++i) {
+        removed[stopKeypoints[i].second] = true;
+    }
+
+    std::vector<KeyPoint> keptKeypoints;
+    Mat keptDescriptors;
+    for (int i = 0; i < (int) keypoints.size(); ++i) {
+        if (!removed[i]) {
+            keptKeypoints.push_back(keypoints[i]);
+            keptDescriptors.push_back(descriptors.row(i));
+        }
+    }
+
+    keypoints = keptKeypoints;
+    descriptors = keptDescriptors;
+    return nbRemovable;
+}
@@ -0,0 +1,42 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#ifndef STOPFEATURES_H
+#define STOPFEATURES_H
+
+#include <QString>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Descriptors that are common in ordinary document content (e.g. glyphs of text, tick marks)
+// Figure keypoints close to them produce most of the false matches, so they are removed from the figures
+class StopFeatures
+{
+public:
+    StopFeatures();
+    void build(cv::Mat pagesDescriptors, int nbWords = 256);
+    bool load(QString path);
+    bool save(QString path);
+    int prune(std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors, int minKeypoints = 30);
+    inline bool isEmpty() {return words.empty();}
+
+private:
+    cv::Mat words;
+    std::vector<float> radiuses;
+};
+
+#endif // STOPFEATURES_H
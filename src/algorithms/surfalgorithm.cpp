@@ -31,5 +31,9 @@ SURFAlgorithm::SURFAlgorithm(double hessianThreshold, int nbOctaves, int nbOctav
 {
     this->detector = this->descriptor = SURF::create(hessianThreshold, nbOctaves, nbOctaveLayers, false, true);
     this->name = "SURF (" + QString::number(hessianThreshold) + ", " + QString::number(nbOctaves) + ", " + QString::number(nbOctaveLayers) + ")";
+
+    // The biggest box filter is applied to the last layer of the last octave, and its descriptor covers ~2 times its size
+    int maxFilterSize = (9 + 6 * (nbOctaveLayers + 1)) << (nbOctaves - 1);
+    this->tileOverlap = 2 * maxFilterSize;
 }
 
@@ -39,6 +39,7 @@ public:
 
     inline double getX() {return virtualX;}
     inline double getY() {return virtualY;}
+    inline int getVirtualWidth() {return virtualWidth;}
 
 signals:
     void figureFound(QRect rect);
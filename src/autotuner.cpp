@@ -0,0 +1,231 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include "autotuner.h"
+#include "algorithms/surfalgorithm.h"
+#include "model/model.h"
+#include <QFile>
+#include <QDir>
+#include <QImage>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QDebug>
+#include <algorithm>
+
+// Parameters explored for SURF, the matching ones are tested for each detection setting as they do not require to detect again
+static const double hessianThresholds[] = {100, 200, 300, 400, 600, 800};
+static const int nbOctavesValues[] = {1, 2, 3, 4};
+static const int nbOctaveLayersValues[] = {2, 3, 4};
+static const double distanceThresholds[] = {0.06, 0.07, 0.08, 0.09, 0.098, 0.11, 0.12, 0.13, 0.14};
+static const int nbAssociationsMaxValues[] = {250, 500, 1000, 2000};
+
+struct DetectedFeatures {
+    std::vector<KeyPoint> keypoints;
+    Mat descriptors;
+};
+
+static Mat loadImage(QString path) {
+    QImage image = QImage(path).convertToFormat(QImage::Format_RGBA8888);
+    if (image.isNull()) {
+        return Mat();
+    }
+    return Mat(image.height(), image.width(), CV_8UC4, (void *) image.constBits(), image.bytesPerLine()).clone();
+}
+
+// Same acceptance rules as FigureFinderTask::getFigureRect
+static bool findFigure(FeatureMatchingAlgorithm& matcher, Size figureSize, DetectedFeatures& figure, DetectedFeatures& scene, Rect* figureRect) {
+    if (scene.keypoints.size() < 2) {
+        return false;
+    }
+
+    Rect rect(-1, -1, -1, -1);
+    if (Model::getInstance()->progressiveMatching.getValue()) {
+        rect = matcher.matchProgressively(figureSize.width, figureSize.height, figure.descriptors, figure.keypoints, scene.descriptors, scene.keypoints);
+    } else {
+        std::vector<DMatch> matches = matcher.match(figure.descriptors, scene.descriptors);
+        if (matches.size() >= 3) {
+            rect = matcher.computeObjectRect(figureSize.width, figureSize.height, matches, figure.keypoints, scene.keypoints);
+        }
+    }
+
+    if (rect.width <= 10 || rect.height <= 10) {
+        return false;
+    }
+
+    double aspectRatioA = ((double) figureSize.width) / figureSize.height;
+    double aspectRatioB = ((double) rect.width) / rect.height;
+    *figureRect = rect;
+    return qAbs((1 - (aspectRatioA / aspectRatioB))) <= 0.1;
+}
+
+AutoTuner::AutoTuner() {
+}
+
+bool AutoTuner::loadCorpus(QString directory) {
+    QFile labels(directory + "/labels.csv");
+    if (!labels.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Cannot open" << labels.fileName();
+        return false;
+    }
+
+    QTextStream stream(&labels);
+    while (!stream.atEnd()) {
+        QStringList fields = stream.readLine().split(",");
+        if (fields.size() != 6 || fields[0].startsWith("#")) {
+            continue;
+        }
+
+        TuningSample sample;
+        sample.screenshot = QDir(directory).filePath(fields[0].trimmed());
+        sample.figure = QDir(directory).filePath(fields[1].trimmed());
+        int x = fields[2].toInt();
+        sample.rect = x < 0 ? Rect() : Rect(x, fields[3].toInt(), fields[4].toInt(), fields[5].toInt());
+
+        for (QString path : {sample.screenshot, sample.figure}) {
+            if (!images.contains(path)) {
+                images[path] = loadImage(path);
+            }
+        }
+
+        if (images[sample.screenshot].empty() || images[sample.figure].empty()) {
+            qWarning() << "Sample ignored, cannot load" << sample.screenshot << "or" << sample.figure;
+            continue;
+        }
+        samples.append(sample);
+    }
+
+    return !samples.isEmpty();
+}
+
+void AutoTuner::run() {
+    results.clear();
+    int nbTiles = Model::getInstance()->nbDetectionTiles.getValue();
+    int maxFigureKeypoints = Model::getInstance()->maxFigureKeypoints.getValue();
+
+    QStringList figures, screenshots;
+    for (TuningSample& sample : samples) {
+        if (!figures.contains(sample.figure)) figures.append(sample.figure);
+        if (!screenshots.contains(sample.screenshot)) screenshots.append(sample.screenshot);
+    }
+
+    for (double hessianThreshold : hessianThresholds) {
+        for (int nbOctaves : nbOctavesValues) {
+            for (int nbOctaveLayers : nbOctaveLayersValues) {
+                SURFAlgorithm algorithm(hessianThreshold, nbOctaves, nbOctaveLayers);
+                algorithm.setNbTiles(nbTiles > 0 ? nbTiles : QThread::idealThreadCount());
+
+                // Figures are processed as when they are registered (stop-features aside, they depend on the engine)
+                QMap<QString, DetectedFeatures> figuresFeatures, screenshotsFeatures;
+                for (QString figure : figures) {
+                    Mat image = images[figure];
+                    DetectedFeatures& f = figuresFeatures[figure];
+                    f.keypoints = algorithm.selectStableKeypoints(image, algorithm.detect(image), maxFigureKeypoints);
+                    f.descriptors = algorithm.compute(image, f.keypoints);
+                }
+
+                QElapsedTimer timer;
+                timer.start();
+                for (QString screenshot : screenshots) {
+                    DetectedFeatures& f = screenshotsFeatures[screenshot];
+                    algorithm.detectAndCompute(images[screenshot], f.keypoints, f.descriptors);
+                }
+                double detectionLatency = ((double) timer.nsecsElapsed()) / 1e6 / screenshots.size();
+
+                for (double distanceThreshold : distanceThresholds) {
+                    for (int nbAssociationsMax : nbAssociationsMaxValues) {
+                        FeatureMatchingAlgorithm matcher(algorithm);
+                        matcher.setDistanceThreshold(distanceThreshold);
+                        matcher.setNbAssociationMax(nbAssociationsMax);
+                        matcher.setProgressiveAcceptance(Model::getInstance()->progressiveMinInliers.getValue(), Model::getInstance()->progressiveMinConsensus.getValue());
+
+                        int nbPositives = 0, nbFound = 0, nbFalsePositives = 0;
+                        timer.restart();
+                        for (TuningSample& sample : samples) {
+                            Mat figureImage = images[sample.figure];
+                            Rect rect;
+                            bool found = findFigure(matcher, figureImage.size(), figuresFeatures[sample.figure], screenshotsFeatures[sample.screenshot], &rect);
+
+                            bool correct = false;
+                            if (sample.rect.area() > 0) {
+                                nbPositives++;
+                                correct = found && (rect & sample.rect).area() >= 0.5 * (rect | sample.rect).area();
+                                nbFound += correct;
+                            }
+                            nbFalsePositives += found && !correct;
+                        }
+
+                        TuningResult result;
+                        result.engine = algorithm.getName();
+                        result.hessianThreshold = hessianThreshold;
+                        result.nbOctaves = nbOctaves;
+                        result.nbOctaveLayers = nbOctaveLayers;
+                        result.distanceThreshold = distanceThreshold;
+                        result.nbAssociationsMax = nbAssociationsMax;
+                        result.latency = detectionLatency + ((double) timer.nsecsElapsed()) / 1e6 / samples.size();
+                        result.recall = nbPositives > 0 ? ((double) nbFound) / nbPositives : 0;
+                        result.falsePositiveRate = ((double) nbFalsePositives) / samples.size();
+                        results.append(result);
+                    }
+                }
+
+                qDebug() << "Tuning:" << algorithm.getName() << "done";
+            }
+        }
+    }
+}
+
+// Configurations for which no other is both faster and has a better recall
+QList<TuningResult> AutoTuner::getParetoFront() {
+    QList<TuningResult> front;
+    for (TuningResult& a : results) {
+        bool dominated = false;
+        for (TuningResult& b : results) {
+            if (b.latency <= a.latency && b.recall >= a.recall && (b.latency < a.latency || b.recall > a.recall)) {
+                dominated = true;
+                break;
+            }
+        }
+        if (!dominated) {
+            front.append(a);
+        }
+    }
+
+    std::sort(front.begin(), front.end(), [](const TuningResult& a, const TuningResult& b) {return a.latency < b.latency;});
+    return front;
+}
+
+// The fastest configuration reaching the accuracy target (or the one with the best recall if none does)
+bool AutoTuner::recommend(double targetRecall, double maxFalsePositiveRate, TuningResult* result) {
+    if (results.isEmpty()) {
+        return false;
+    }
+
+    const TuningResult* best = NULL;
+    const TuningResult* bestRecall = &results.first();
+    for (const TuningResult& r : results) {
+        if (r.recall > bestRecall->recall || (r.recall == bestRecall->recall && r.latency < bestRecall->latency)) {
+            bestRecall = &r;
+        }
+        if (r.recall >= targetRecall && r.falsePositiveRate <= maxFalsePositiveRate && (best == NULL || r.latency < best->latency)) {
+            best = &r;
+        }
+    }
+
+    *result = best != NULL ? *best : *bestRecall;
+    return best != NULL;
+}
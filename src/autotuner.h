@@ -0,0 +1,65 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#ifndef AUTOTUNER_H
+#define AUTOTUNER_H
+
+#include <QString>
+#include <QList>
+#include <QMap>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// A screenshot of the corpus and where a figure appears in it (empty rect if the figure is not in the screenshot)
+struct TuningSample {
+    QString screenshot;
+    QString figure;
+    cv::Rect rect;
+};
+
+struct TuningResult {
+    QString engine;
+    double hessianThreshold;
+    int nbOctaves;
+    int nbOctaveLayers;
+    double distanceThreshold;
+    int nbAssociationsMax;
+    double latency; // Detection of one screenshot + matching of one figure, in ms
+    double recall; // Ratio of the figures found at the right place
+    double falsePositiveRate; // Ratio of the samples where a figure was found at the wrong place (or where there is none)
+};
+
+// Offline search of the detection and matching parameters on a labeled corpus
+// The corpus is a directory with the images and a labels.csv file, each line being:
+// screenshot,figure,x,y,width,height (paths relative to the directory, x = -1 if the figure is not in the screenshot)
+class AutoTuner
+{
+public:
+    AutoTuner();
+    bool loadCorpus(QString directory);
+    void run();
+    QList<TuningResult> getParetoFront();
+    bool recommend(double targetRecall, double maxFalsePositiveRate, TuningResult* result);
+    inline QList<TuningResult> getResults() {return results;}
+
+private:
+    QList<TuningSample> samples;
+    QMap<QString, cv::Mat> images;
+    QList<TuningResult> results;
+};
+
+#endif // AUTOTUNER_H
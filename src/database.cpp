@@ -32,16 +32,65 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include <QDir>
 #include <QDebug>
 #include <QFile>
+#include <QCoreApplication>
+#include <QBuffer>
+#include <QImage>
+#include <QRunnable>
+#include <QThreadPool>
 #include "figurefindertask.h"
 #include "algorithms/featurematchingalgorithm.h"
+#include "model/model.h"
 
 using namespace cv;
 
+// Algorithm that produced the keypoints/descriptors stored in the figures table before the features table existed
+#define LEGACY_ENGINE "SURF (300, 2, 3)"
+
+class FeaturesComputationTask : public QRunnable
+{
+public:
+    FeaturesComputationTask(Database* database) : database(database) {}
+    void run() {database->computeMissingFeatures();}
+
+private:
+    Database* database;
+};
+
+static QString serializeKeypoints(std::vector<KeyPoint>& keypoints) {
+    cv::FileStorage file(".bin", FileStorage::WRITE + FileStorage::MEMORY);
+    file << "keypoints" << keypoints;
+    return QString::fromStdString(file.releaseAndGetString());
+}
+
+static QString serializeDescriptors(Mat& descriptors) {
+    cv::FileStorage file(".bin", FileStorage::WRITE + FileStorage::MEMORY);
+    file << "descriptors" << descriptors;
+    return QString::fromStdString(file.releaseAndGetString());
+}
+
+// Figures' images are stored as PNG so that the features of new algorithms can be computed without registering figures again
+static QByteArray encodeImage(Mat image) {
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    QImage((uchar*) image.data, image.cols, image.rows, image.step, QImage::Format_RGBA8888).save(&buffer, "PNG");
+    return data;
+}
+
+static Mat decodeImage(QByteArray data) {
+    QImage image = QImage::fromData(data, "PNG").convertToFormat(QImage::Format_RGBA8888);
+    if (image.isNull()) {
+        return Mat();
+    }
+    return Mat(image.height(), image.width(), CV_8UC4, (void *) image.constBits(), image.bytesPerLine()).clone();
+}
+
 Database::Database() {
     db = QSqlDatabase::addDatabase("QSQLITE");
     QString dbLocation = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
     QDir().mkpath(dbLocation);
     url = QUrl(dbLocation + "/figures.db");
+    stopFeaturesPath = dbLocation + "/stopfeatures.yml";
 }
 
 void Database::load() {
@@ -53,8 +102,152 @@ void Database::load() {
     // Required only once, but will fail silently if already done
     QSqlQuery query;
     query.exec("create table figures (id integer primary key, filesize integer, md5 string, width integer, height integer, keypoints string, descriptors string, url string)");
+    // Columns added after the first version of the database (fail silently if they already exist)
+    query.exec("alter table figures add column distanceThreshold real default -1");
+    query.exec("alter table figures add column nbAssociationsMax integer default -1");
+    query.exec("alter table figures add column image blob");
+
+    // Keypoints and descriptors of each figure, for each algorithm (engine) that was used with it
+    query.exec("create table features (figure integer, engine string, keypoints string, descriptors string, primary key (figure, engine))");
+    query.exec("insert into features (figure, engine, keypoints, descriptors) select id, '" LEGACY_ENGINE "', keypoints, descriptors from figures where id not in (select figure from features)");
+
+    // Global descriptor of the page (window) on which each figure was registered, see PageIndex
+    query.exec("create table pages (figure integer primary key, path string, descriptor blob)");
+    if (query.exec("SELECT figure, path, descriptor FROM pages")) {
+        while (query.next()) {
+            QByteArray descriptor = query.value(2).toByteArray();
+            Mat descriptorMat(1, descriptor.size() / sizeof(float), CV_32F, (void *) descriptor.constData());
+            pageIndex.add(query.value(0).toInt(), query.value(1).toString(), descriptorMat.clone());
+        }
+    }
+
+    // Optional, built with --build-stop-features
+    if (stopFeatures.load(stopFeaturesPath)) {
+        qDebug() << "Stop-features loaded";
+    }
+
+    // Prepare the features of the current algorithm for the figures registered with another one
+    QThreadPool::globalInstance()->start(new FeaturesComputationTask(this));
+}
+
+// Compute the features of *image* that will be stored for the current algorithm
+void Database::extractFeatures(Mat image, std::vector<KeyPoint>* keypoints, Mat* descriptors) {
+    // Converted like the grayscale captures
+    image = FeatureMatchingAlgorithm::toGrayscale(image);
+    *keypoints = FigureFinderTask::featureMatchingAlgorithm->detect(image);
+    // Every stored descriptor is matched on every frame, so we only keep the most useful ones
+    *keypoints = FigureFinderTask::featureMatchingAlgorithm->selectStableKeypoints(image, *keypoints, Model::getInstance()->maxFigureKeypoints.getValue());
+    *descriptors = FigureFinderTask::featureMatchingAlgorithm->compute(image, *keypoints);
+    stopFeatures.prune(*keypoints, *descriptors);
 }
 
+// Must be called with databaseAccess locked
+bool Database::loadFeatures(int figureId, QString engine, std::vector<KeyPoint>* keypoints, Mat* descriptors) {
+    QSqlQuery query(db);
+    query.prepare("SELECT keypoints, descriptors FROM features WHERE figure = :figure AND engine = :engine");
+    query.bindValue(":figure", figureId);
+    query.bindValue(":engine", engine);
+
+    if (!query.exec() || !query.next()) {
+        return false;
+    }
+
+    cv::FileStorage keypointsFile(query.value(0).toString().toStdString(), cv::FileStorage::READ + FileStorage::MEMORY);
+    keypointsFile["keypoints"] >> *keypoints;
+
+    cv::FileStorage descriptorsFile(query.value(1).toString().toStdString(), cv::FileStorage::READ + FileStorage::MEMORY);
+    descriptorsFile["descriptors"] >> *descriptors;
+    return true;
+}
+
+// Load the features computed by another engine, the legacy one first (stored for all the figures registered before their image)
+// Matching them with the scene's features of the current engine is less accurate, but better than not detecting the figure at all
+// Returns the engine of the features, or an empty string if the figure has none
+// Must be called with databaseAccess locked
+QString Database::loadFallbackFeatures(int figureId, std::vector<KeyPoint>* keypoints, Mat* descriptors) {
+    QSqlQuery query(db);
+    query.prepare("SELECT engine FROM features WHERE figure = :figure ORDER BY engine = :legacy DESC LIMIT 1");
+    query.bindValue(":figure", figureId);
+    query.bindValue(":legacy", LEGACY_ENGINE);
+
+    if (!query.exec() || !query.next()) {
+        return QString();
+    }
+
+    QString engine = query.value(0).toString();
+    return loadFeatures(figureId, engine, keypoints, descriptors) ? engine : QString();
+}
+
+// Must be called with databaseAccess locked
+void Database::saveFeatures(int figureId, QString engine, std::vector<KeyPoint>& keypoints, Mat& descriptors) {
+    QSqlQuery query(db);
+    query.prepare("INSERT OR REPLACE INTO features (figure, engine, keypoints, descriptors) VALUES (:figure, :engine, :keypoints, :descriptors)");
+    query.bindValue(":figure", figureId);
+    query.bindValue(":engine", engine);
+    query.bindValue(":keypoints", serializeKeypoints(keypoints));
+    query.bindValue(":descriptors", serializeDescriptors(descriptors));
+    query.exec();
+}
+
+// Compute the features of the current algorithm for all the figures that do not have them yet
+// Only possible for figures whose image is stored (i.e. registered since images are stored)
+void Database::computeMissingFeatures() {
+    QString engine = FigureFinderTask::featureMatchingAlgorithm->getName();
+    QList<QPair<int, QByteArray>> missing;
+
+    databaseAccess.lock();
+    QSqlQuery query(db);
+    query.prepare("SELECT id, image FROM figures WHERE image IS NOT NULL AND id NOT IN (SELECT figure FROM features WHERE engine = :engine)");
+    query.bindValue(":engine", engine);
+    if (query.exec()) {
+        while (query.next()) {
+            missing.append(QPair<int, QByteArray>(query.value(0).toInt(), query.value(1).toByteArray()));
+        }
+    }
+    databaseAccess.unlock();
+
+    // The database is only locked to store the results, so that figures can still be loaded meanwhile
+    for (auto figure : missing) {
+        Mat image = decodeImage(figure.second);
+        if (image.empty()) {
+            continue;
+        }
+
+        std::vector<KeyPoint> keypoints;
+        Mat descriptors;
+        extractFeatures(image, &keypoints, &descriptors);
+
+        databaseAccess.lock();
+        saveFeatures(figure.first, engine, keypoints, descriptors);
+        databaseAccess.unlock();
+    }
+
+    if (!missing.isEmpty()) {
+        qDebug() << "Features computed for" << missing.size() << "figures with" << engine;
+    }
+}
+
+// Number of figures that would be matched with the features of another engine than *engine* (see loadFallbackFeatures)
+// i.e. registered before their image was stored, and never processed with *engine*. Can be called before load()
+int Database::countFiguresWithoutFeatures(QString engine) {
+    databaseAccess.lock();
+    if (!db.isOpen()) {
+        db.setDatabaseName(url.toString());
+        db.open();
+    }
+
+    QSqlQuery query(db);
+    query.prepare("SELECT COUNT(*) FROM figures WHERE image IS NULL AND id NOT IN (SELECT figure FROM features WHERE engine = :engine)");
+    query.bindValue(":engine", engine);
+    // Databases not loaded since the images are stored have neither the column nor the table, and none of their figures has an image
+    if (!query.exec()) {
+        query.exec("SELECT COUNT(*) FROM figures");
+    }
+    int count = query.next() ? query.value(0).toInt() : 0;
+    databaseAccess.unlock();
+
+    return count;
+}
 
 // Load the augmented figures stored in the database for the specified file
 QList<Figure*> Database::getFiguresOfFile(const char* filePath) {
@@ -64,7 +257,7 @@ QList<Figure*> Database::getFiguresOfFile(const char* filePath) {
 
 
     QSqlQuery query(db);
-    query.prepare("SELECT width, height, keypoints, descriptors, url, id, md5 FROM figures WHERE filesize = (:filesize)");
+    query.prepare("SELECT width, height, image, url, id, md5, distanceThreshold, nbAssociationsMax FROM figures WHERE filesize = (:filesize)");
     query.bindValue(":filesize", file.size());
 
     if (query.exec()) {
@@ -81,10 +274,8 @@ QList<Figure*> Database::getFiguresOfFile(const char* filePath) {
             if (fileMD5 == md5) {
                 int width = query.value(0).toInt();
                 int height = query.value(1).toInt();
-                QString keypoints = query.value(2).toString();
-                QString descriptors = query.value(3).toString();
-                QString url = query.value(4).toString();
-                int id = query.value(5).toInt();
+                QString url = query.value(3).toString();
+                int id = query.value(4).toInt();
 
                 std::vector<KeyPoint> keypointsVect;
                 Mat descriptorsMat;
@@ -101,13 +292,31 @@ QList<Figure*> Database::getFiguresOfFile(const char* filePath) {
                 }
 
                 if (figure == NULL) {
-                    figure = new Figure(id, width, height, keypointsVect, descriptorsMat, QUrl(url));
+                    QString engine = FigureFinderTask::featureMatchingAlgorithm->getName();
+
+                    if (!loadFeatures(id, engine, &keypointsVect, &descriptorsMat)) {
+                        // Not computed in the background yet, so we compute them now (file hooks usually call us from their own thread)
+                        Mat image = decodeImage(query.value(2).toByteArray());
+                        if (!image.empty()) {
+                            extractFeatures(image, &keypointsVect, &descriptorsMat);
+                            saveFeatures(id, engine, keypointsVect, descriptorsMat);
+                        } else {
+                            QString fallbackEngine = loadFallbackFeatures(id, &keypointsVect, &descriptorsMat);
+                            if (fallbackEngine.isEmpty()) {
+                                qWarning() << "Figure" << id << "has no features and no image to compute them, it cannot be detected";
+                                continue;
+                            }
+                            qWarning() << "Figure" << id << "has no image to compute its features for" << engine << "- using the ones of" << fallbackEngine;
+                        }
+                    }
 
-                    cv::FileStorage keypointsFile(keypoints.toStdString(), cv::FileStorage::READ + FileStorage::MEMORY);
-                    keypointsFile["keypoints"] >> figure->getKeypoints();
+                    figure = new Figure(id, width, height, keypointsVect, descriptorsMat, QUrl(url));
 
-                    cv::FileStorage descriptorsFile(descriptors.toStdString(), cv::FileStorage::READ + FileStorage::MEMORY);
-                    descriptorsFile["descriptors"] >> figure->getDescriptors();
+                    figure->setCalibration(query.value("distanceThreshold").toDouble(), query.value("nbAssociationsMax").toInt());
+                    // Persist the calibration from the main thread, as it is computed by the analysis threads
+                    QObject::connect(figure, &Figure::calibrated, qApp, [this](int id, double distanceThreshold, int nbAssociationsMax) {
+                        updateFigureCalibration(id, distanceThreshold, nbAssociationsMax);
+                    }, Qt::QueuedConnection);
 
                     figures.append(figure);
                 }
@@ -121,30 +330,45 @@ QList<Figure*> Database::getFiguresOfFile(const char* filePath) {
     return result;
 }
 
-void Database::saveFigureInDb(Mat image, ObservedFile& file, QUrl url) {
+void Database::saveFigureInDb(Mat image, ObservedFile& file, QUrl url, Mat page) {
     databaseAccess.lock();
-    std::vector<KeyPoint> vectKeypoints = FigureFinderTask::featureMatchingAlgorithm->detect(image);
-
-    cv::FileStorage keypoints(".bin", FileStorage::WRITE + FileStorage::MEMORY);
-    keypoints << "keypoints" << vectKeypoints;
+    std::vector<KeyPoint> vectKeypoints;
+    Mat descriptorsMat;
+    extractFeatures(image, &vectKeypoints, &descriptorsMat);
 
-    cv::FileStorage descriptors(".bin", FileStorage::WRITE + FileStorage::MEMORY);
-    Mat descriptorsMat = FigureFinderTask::featureMatchingAlgorithm->compute(image, vectKeypoints);
-    descriptors << "descriptors" << descriptorsMat;
+    QString keypoints = serializeKeypoints(vectKeypoints);
+    QString descriptors = serializeDescriptors(descriptorsMat);
 
     qint64 size = file.getSize();
     QString md5 = file.getMD5();
 
+    // The keypoints/descriptors columns are still filled for older versions of Chameleon
     QSqlQuery query(db);
-    query.prepare("INSERT INTO figures (filesize, md5, width, height, keypoints, descriptors, url) VALUES (:filesize, :md5, :width, :height, :keypoints, :descriptors, :url)");
+    query.prepare("INSERT INTO figures (filesize, md5, width, height, keypoints, descriptors, url, image) VALUES (:filesize, :md5, :width, :height, :keypoints, :descriptors, :url, :image)");
     query.bindValue(":filesize", size);
     query.bindValue(":md5", md5);
     query.bindValue(":width", image.cols);
     query.bindValue(":height", image.rows);
-    query.bindValue(":keypoints", keypoints.releaseAndGetString().c_str());
-    query.bindValue(":descriptors", descriptors.releaseAndGetString().c_str());
+    query.bindValue(":keypoints", keypoints);
+    query.bindValue(":descriptors", descriptors);
     query.bindValue(":url", url.toString());
-    query.exec();
+    query.bindValue(":image", encodeImage(image));
+
+    if (query.exec()) {
+        int id = query.lastInsertId().toInt();
+        saveFeatures(id, FigureFinderTask::featureMatchingAlgorithm->getName(), vectKeypoints, descriptorsMat);
+
+        Mat pageDescriptor = PageIndex::describe(page);
+        if (!pageDescriptor.empty()) {
+            QSqlQuery pageQuery(db);
+            pageQuery.prepare("INSERT OR REPLACE INTO pages (figure, path, descriptor) VALUES (:figure, :path, :descriptor)");
+            pageQuery.bindValue(":figure", id);
+            pageQuery.bindValue(":path", file.getPath());
+            pageQuery.bindValue(":descriptor", QByteArray((const char*) pageDescriptor.data, pageDescriptor.total() * pageDescriptor.elemSize()));
+            pageQuery.exec();
+            pageIndex.add(id, file.getPath(), pageDescriptor);
+        }
+    }
 
     image.release();
     databaseAccess.unlock();
@@ -201,9 +425,71 @@ void Database::updateFigureUrl(QString oldUrl, QString newUrl) {
     databaseAccess.unlock();
 }
 
+void Database::updateFigureCalibration(int id, double distanceThreshold, int nbAssociationsMax) {
+    databaseAccess.lock();
+    QSqlQuery query(db);
+    query.prepare("UPDATE figures SET distanceThreshold = :distanceThreshold, nbAssociationsMax = :nbAssociationsMax WHERE id = :id");
+    query.bindValue(":distanceThreshold", distanceThreshold);
+    query.bindValue(":nbAssociationsMax", nbAssociationsMax);
+    query.bindValue(":id", id);
+    query.exec();
+    databaseAccess.unlock();
+}
+
+// Returns the path of the document shown in *screenshot* (a window whose file is unknown), or an empty string
+// The page index has its own lock, so this does not wait for the database
+QString Database::identifyDocument(Mat screenshot) {
+    QString path = pageIndex.query(PageIndex::describe(screenshot));
+
+    if (!path.isEmpty() && !QFile::exists(path)) {
+        qDebug() << "Document identified visually but not found anymore:" << path;
+        return QString();
+    }
+    return path;
+}
+
+// Remove the stop-features from the figures already in the database (e.g. registered before the stop-features were built)
+// Returns the number of keypoints removed
+int Database::pruneStopFeatures() {
+    databaseAccess.lock();
+    int nbRemoved = 0;
+
+    // Stop-features are only valid for the descriptors of the current algorithm
+    QString engine = FigureFinderTask::featureMatchingAlgorithm->getName();
+    QList<int> figureIds;
+    QSqlQuery query(db);
+    query.prepare("SELECT figure FROM features WHERE engine = :engine");
+    query.bindValue(":engine", engine);
+
+    if (!stopFeatures.isEmpty() && query.exec()) {
+        while (query.next()) {
+            figureIds.append(query.value(0).toInt());
+        }
+    }
+
+    for (auto figureId : figureIds) {
+        std::vector<KeyPoint> vectKeypoints;
+        Mat descriptorsMat;
+
+        if (loadFeatures(figureId, engine, &vectKeypoints, &descriptorsMat)) {
+            int nbFigureRemoved = stopFeatures.prune(vectKeypoints, descriptorsMat);
+            if (nbFigureRemoved > 0) {
+                saveFeatures(figureId, engine, vectKeypoints, descriptorsMat);
+                nbRemoved += nbFigureRemoved;
+            }
+        }
+    }
+
+    databaseAccess.unlock();
+    return nbRemoved;
+}
+
 void Database::deleteFigure(int id) {
     databaseAccess.lock();
     db.exec("delete from figures where id = " + QString::number(id));
+    db.exec("delete from features where figure = " + QString::number(id));
+    db.exec("delete from pages where figure = " + QString::number(id));
+    pageIndex.remove(id);
 
     QMutableListIterator<Figure*> i(figures);
     while (i.hasNext()) {
@@ -23,6 +23,8 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include <QUrl>
 #include <opencv2/opencv.hpp>
 #include "observedfile.h"
+#include "algorithms/stopfeatures.h"
+#include "algorithms/pageindex.h"
 
 class Figure;
 
@@ -31,7 +33,7 @@ class Database
 public:
     Database();
     void load();
-    void saveFigureInDb(cv::Mat image, ObservedFile& file, QUrl url);
+    void saveFigureInDb(cv::Mat image, ObservedFile& file, QUrl url, cv::Mat page = cv::Mat());
     void deleteFigure(int id);
 
     QList<Figure*> getFiguresOfFile(const char* filePath);
@@ -39,13 +41,28 @@ public:
     bool getFigureDetails(int figureId, int* width, int* height, int* fileSize, QString* md5);
     void updateMD5(QString oldMD5, QString newMD5, qint64 newSize);
     void updateFigureUrl(QString oldUrl, QString newUrl);
+    void updateFigureCalibration(int id, double distanceThreshold, int nbAssociationsMax);
+    int pruneStopFeatures();
+    void computeMissingFeatures();
+    int countFiguresWithoutFeatures(QString engine);
+    QString identifyDocument(cv::Mat screenshot);
     inline QUrl getUrl() {return url;}
+    inline QString getStopFeaturesPath() {return stopFeaturesPath;}
+    inline StopFeatures& getStopFeatures() {return stopFeatures;}
 
 private:
+    void extractFeatures(cv::Mat image, std::vector<cv::KeyPoint>* keypoints, cv::Mat* descriptors);
+    bool loadFeatures(int figureId, QString engine, std::vector<cv::KeyPoint>* keypoints, cv::Mat* descriptors);
+    QString loadFallbackFeatures(int figureId, std::vector<cv::KeyPoint>* keypoints, cv::Mat* descriptors);
+    void saveFeatures(int figureId, QString engine, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors);
+
     QMutex databaseAccess;
     QSqlDatabase db;
     QList<Figure*> figures;
     QUrl url;
+    QString stopFeaturesPath;
+    StopFeatures stopFeatures;
+    PageIndex pageIndex;
 };
 
 #endif // DATABASE_H
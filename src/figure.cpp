@@ -16,10 +16,107 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include "figure.h"
+#include "algorithms/featurematchingalgorithm.h"
 
 using namespace cv;
 
+#define CALIBRATION_WINDOW 20
+#define CALIBRATION_MIN_DETECTIONS 5
+// Past this number of misses in a row (see recordMiss), the calibrated thresholds are too strict for the figure
+#define CALIBRATION_MAX_MISSES 3
+
 Figure::Figure(int id, int width, int height, std::vector<KeyPoint> keypoints, Mat descriptors, QUrl url) :
-    id(id), width(width), height(height), keypoints(keypoints), descriptors(descriptors), url(url) {
+    id(id), width(width), height(height), keypoints(keypoints), descriptors(descriptors), url(url),
+    nbConsecutiveMisses(0), calibratedDistanceThreshold(-1), calibratedNbAssociationsMax(-1) {
+
+}
+
+void Figure::setCalibration(double distanceThreshold, int nbAssociationsMax) {
+    calibrationMutex.lock();
+    calibratedDistanceThreshold = distanceThreshold;
+    calibratedNbAssociationsMax = nbAssociationsMax;
+    calibrationMutex.unlock();
+}
+
+// Record the matches of a successful detection of the figure
+void Figure::recordDetection(const MatchingStats& stats) {
+    if (stats.inlierDistances.empty()) {
+        return;
+    }
+
+    std::vector<float> distances = stats.inlierDistances;
+    std::sort(distances.begin(), distances.end());
+
+    calibrationMutex.lock();
+    nbConsecutiveMisses = 0;
+    detectionDistances.append(distances[(distances.size() - 1) * 95 / 100]);
+    detectionRanks.append(stats.lastInlierRank);
+    lastResults.append(true);
+    while (detectionDistances.size() > CALIBRATION_WINDOW) {
+        detectionDistances.removeFirst();
+        detectionRanks.removeFirst();
+    }
+    while (lastResults.size() > CALIBRATION_WINDOW) {
+        lastResults.removeFirst();
+    }
+    calibrate();
+    calibrationMutex.unlock();
+}
+
+// Record a placement rejected by the aspect ratio check (i.e. a false positive)
+void Figure::recordRejection() {
+    calibrationMutex.lock();
+    lastResults.append(false);
+    while (lastResults.size() > CALIBRATION_WINDOW) {
+        lastResults.removeFirst();
+    }
+    calibrationMutex.unlock();
+}
+
+// Record a matching in which the calibrated thresholds did not locate the figure, while the global ones did
+// The thresholds only ever get stricter, so after too many misses they go back to the global ones and are learnt again
+void Figure::recordMiss() {
+    calibrationMutex.lock();
+    if (calibratedDistanceThreshold > 0 || calibratedNbAssociationsMax > 0) {
+        nbConsecutiveMisses++;
+        if (nbConsecutiveMisses >= CALIBRATION_MAX_MISSES) {
+            nbConsecutiveMisses = 0;
+            detectionDistances.clear();
+            detectionRanks.clear();
+            lastResults.clear();
+            calibratedDistanceThreshold = -1;
+            calibratedNbAssociationsMax = -1;
+            emit calibrated(id, -1, -1);
+        }
+    }
+    calibrationMutex.unlock();
+}
+
+// Derive the thresholds keeping only the matches the last detections actually needed (plus a safety margin)
+// Must be called with calibrationMutex locked
+void Figure::calibrate() {
+    if (detectionDistances.size() < CALIBRATION_MIN_DETECTIONS) {
+        return;
+    }
+
+    double maxDistance = 0;
+    int maxRank = 0;
+    for (int i = 0; i < detectionDistances.size(); ++i) {
+        maxDistance = qMax(maxDistance, detectionDistances[i]);
+        maxRank = qMax(maxRank, detectionRanks[i]);
+    }
+
+    // Frequent false positives mean that too many noisy matches reach RANSAC, so we keep a smaller margin
+    int nbRejections = lastResults.count(false);
+    double margin = nbRejections * 2 > lastResults.size() ? 1.1 : 1.25;
+
+    double distanceThreshold = margin * maxDistance;
+    int nbAssociationsMax = qMax(50, 2 * (maxRank + 1));
 
+    // Only persist significant changes
+    if (qAbs(distanceThreshold - calibratedDistanceThreshold) > 0.05 * distanceThreshold || qAbs(nbAssociationsMax - calibratedNbAssociationsMax) > 0.05 * nbAssociationsMax) {
+        calibratedDistanceThreshold = distanceThreshold;
+        calibratedNbAssociationsMax = nbAssociationsMax;
+        emit calibrated(id, distanceThreshold, nbAssociationsMax);
+    }
 }
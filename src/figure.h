@@ -21,12 +21,16 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include <vector>
 #include <QUrl>
 #include <QObject>
+#include <QMutex>
+#include <QList>
 #include <opencv2/opencv.hpp>
 #include "opencv2/core/core.hpp"
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/objdetect/objdetect.hpp>
 #include <opencv2/features2d.hpp>
 
+struct MatchingStats;
+
 class Figure : public QObject
 {
     Q_OBJECT
@@ -40,10 +44,19 @@ public:
     inline cv::Mat& getDescriptors() {return descriptors;}
     inline QUrl getUrl() {return url;}
 
+    // Matching thresholds calibrated for this figure (<= 0 when not calibrated)
+    inline double getDistanceThreshold() {return calibratedDistanceThreshold;}
+    inline int getNbAssociationsMax() {return calibratedNbAssociationsMax;}
+    void setCalibration(double distanceThreshold, int nbAssociationsMax);
+    void recordDetection(const MatchingStats& stats);
+    void recordRejection();
+    void recordMiss();
+
     bool operator==(const Figure& other) const {return other.id == this->id;}
 
 signals:
     void deleted(int id);
+    void calibrated(int id, double distanceThreshold, int nbAssociationsMax);
 
 private:
     int id;
@@ -52,6 +65,16 @@ private:
     std::vector<cv::KeyPoint> keypoints;
     cv::Mat descriptors;
     QUrl url;
+
+    void calibrate();
+
+    QMutex calibrationMutex;
+    QList<double> detectionDistances; // Worst inlier distance (95th percentile) of the last detections
+    QList<int> detectionRanks; // Rank of the worst inlier of the last detections
+    QList<bool> lastResults; // Detections (true) and rejections by the aspect ratio check (false)
+    int nbConsecutiveMisses; // Figure found by the global thresholds only, since its last detection
+    double calibratedDistanceThreshold;
+    int calibratedNbAssociationsMax;
 };
 
 #endif // FIGURE_H
@@ -20,19 +20,30 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include "algorithms/featurematchingalgorithm.h"
 #include "algorithms/surfalgorithm.h"
 #include "figure.h"
+#include "os_specific/screenshotpool.h"
+#include "remoteanalyzer.h"
 #include <QThread>
+#include <QThreadPool>
 #include <QDebug>
 #include <QDateTime>
 #include <model/model.h>
 
-FeatureMatchingAlgorithm* FigureFinderTask::featureMatchingAlgorithm = new SURFAlgorithm(300, 2, 3);
+// Past this number of frames in a row analyzed by shifting the keypoints of the previous one, a frame is fully analyzed
+#define MAX_SHIFTED_DETECTIONS 10
 
-FigureFinderTask::FigureFinderTask(ObservedWindow* observedWindow) :
-    observedWindow(observedWindow)  {
+FeatureMatchingAlgorithm* FigureFinderTask::featureMatchingAlgorithm = FigureFinderTask::createFeatureMatchingAlgorithm();
+
+FeatureMatchingAlgorithm* FigureFinderTask::createFeatureMatchingAlgorithm() {
+    Model* model = Model::getInstance();
+    return new SURFAlgorithm(model->surfHessianThreshold.getValue(), model->surfNbOctaves.getValue(), model->surfNbOctaveLayers.getValue());
+}
+
+FigureFinderTask::FigureFinderTask(ObservedWindow* observedWindow, Stage stage) :
+    observedWindow(observedWindow), stage(stage)  {
     this->setAutoDelete(true);
 }
 
-bool FigureFinderTask::getFigureRect(Figure* figure, std::vector<KeyPoint>& sceneKeypoints, Mat& sceneDescriptors, cv::Rect* figureRect, int* reason) {
+bool FigureFinderTask::getFigureRect(Figure* figure, std::vector<KeyPoint>& sceneKeypoints, Mat& sceneDescriptors, QPoint sceneOrigin, cv::Rect* figureRect, int* reason) {
     *reason = 1;
 
     if (sceneKeypoints.size() < 2)  {
@@ -40,45 +51,148 @@ bool FigureFinderTask::getFigureRect(Figure* figure, std::vector<KeyPoint>& scen
         return false;
     }
 
-    featureMatchingAlgorithm->setDistanceThreshold(Model::getInstance()->distanceThreshold.getValue());
-    featureMatchingAlgorithm->setNbAssociationMax(Model::getInstance()->nbAssociationsMax.getValue());
+    double globalDistanceThreshold = Model::getInstance()->distanceThreshold.getValue();
+    int globalNbAssociationsMax = Model::getInstance()->nbAssociationsMax.getValue();
+    double distanceThreshold = globalDistanceThreshold;
+    int nbAssociationsMax = globalNbAssociationsMax;
+    bool calibrate = Model::getInstance()->calibrateFigureThresholds.getValue();
+
+    // Calibrated thresholds can only make the global ones stricter
+    if (calibrate && figure->getDistanceThreshold() > 0) {
+        distanceThreshold = distanceThreshold > 0 ? qMin(distanceThreshold, figure->getDistanceThreshold()) : figure->getDistanceThreshold();
+    }
+    if (calibrate && figure->getNbAssociationsMax() > 0) {
+        nbAssociationsMax = nbAssociationsMax > 0 ? qMin(nbAssociationsMax, figure->getNbAssociationsMax()) : figure->getNbAssociationsMax();
+    }
 
-    std::vector<DMatch> matches = featureMatchingAlgorithm->match(figure->getDescriptors(), sceneDescriptors);
-    if (matches.size() >= 3) { // Need at least 3 matches to compute the figure's rectangle.
-        Rect rect = featureMatchingAlgorithm->computeObjectRect(figure->getWidth(), figure->getHeight(), matches, figure->getKeypoints(), sceneKeypoints);
+    MatchingStats stats;
+    Rect rect = locateFigure(figure, distanceThreshold, nbAssociationsMax, sceneKeypoints, sceneDescriptors, &stats);
 
-        double aspectRatioA = ((double) figure->getWidth()) / figure->getHeight();
-        double aspectRatioB = ((double) rect.width) / rect.height;
-        bool aspectRatioCorrect = qAbs((1 - (aspectRatioA / aspectRatioB))) <= 0.1;
+    if (rect.width >= 0) {
+        bool aspectRatioCorrect = hasAspectRatioOf(figure, rect);
 
         if (rect.width > 10 && rect.height > 10 && aspectRatioCorrect) {
-            figureRect->x = observedWindow->getX() + rect.x;
-            figureRect->y = observedWindow->getY() + rect.y;
+            figureRect->x = sceneOrigin.x() + rect.x;
+            figureRect->y = sceneOrigin.y() + rect.y;
             figureRect->width = rect.width;
             figureRect->height = rect.height;
+            if (calibrate) {
+                figure->recordDetection(stats);
+            }
             *reason = 0;
             return true;
         }
 
+        if (calibrate && !aspectRatioCorrect) {
+            figure->recordRejection();
+        }
         *reason = 3;
     }
     *reason = 4;
 
+    // The figure is usually just not shown, which does not tell anything about the calibration
+    // It only counts as a miss if the global thresholds would have found it
+    if (calibrate && (distanceThreshold != globalDistanceThreshold || nbAssociationsMax != globalNbAssociationsMax)) {
+        Rect globalRect = locateFigure(figure, globalDistanceThreshold, globalNbAssociationsMax, sceneKeypoints, sceneDescriptors, NULL);
+        if (globalRect.width > 10 && globalRect.height > 10 && hasAspectRatioOf(figure, globalRect)) {
+            figure->recordMiss();
+        }
+    }
+
     return false;
 }
 
+// Rect of *figure* in the scene (width of -1 if not found)
+Rect FigureFinderTask::locateFigure(Figure* figure, double distanceThreshold, int nbAssociationsMax, std::vector<KeyPoint>& sceneKeypoints, Mat& sceneDescriptors, MatchingStats* stats) {
+    // Thresholds are now specific to each figure, so the matching tasks running concurrently cannot share the same instance
+    FeatureMatchingAlgorithm matcher(*featureMatchingAlgorithm);
+    matcher.setDistanceThreshold(distanceThreshold);
+    matcher.setNbAssociationMax(nbAssociationsMax);
+
+    Rect rect(-1, -1, -1, -1);
+    if (Model::getInstance()->progressiveMatching.getValue()) {
+        matcher.setProgressiveAcceptance(Model::getInstance()->progressiveMinInliers.getValue(), Model::getInstance()->progressiveMinConsensus.getValue());
+        rect = matcher.matchProgressively(figure->getWidth(), figure->getHeight(), figure->getDescriptors(), figure->getKeypoints(), sceneDescriptors, sceneKeypoints, stats);
+    } else {
+        std::vector<DMatch> matches = matcher.match(figure->getDescriptors(), sceneDescriptors);
+        if (matches.size() >= 3) { // Need at least 3 matches to compute the figure's rectangle.
+            rect = matcher.computeObjectRect(figure->getWidth(), figure->getHeight(), matches, figure->getKeypoints(), sceneKeypoints, stats);
+        }
+    }
+
+    return rect;
+}
+
+bool FigureFinderTask::hasAspectRatioOf(Figure* figure, Rect rect) {
+    double aspectRatioA = ((double) figure->getWidth()) / figure->getHeight();
+    double aspectRatioB = ((double) rect.width) / rect.height;
+    return qAbs((1 - (aspectRatioA / aspectRatioB))) <= 0.1;
+}
+
 void FigureFinderTask::run() {
-    if (!observedWindow->getAnalysisMutex().tryLock(100)) {
-        return;
+    switch (stage) {
+    case Capture:
+        capture();
+        break;
+    case Detection:
+        detect();
+        break;
+    case Matching:
+        match();
+        break;
     }
+}
+
+// By the time a frame reaches a stage, the document might have been modified (e.g. resized, moved, or scrolled) making the frame outdated
+// We detect this by comparing the current scroll position/geometry to the scroll position/geometry when we took the screenshot
+bool FigureFinderTask::isOutdated(const AnalysisFrame& frame) {
+    return qAbs(frame.hScrollPos - observedWindow->getHScrollPos()) >= 0.1 || qAbs(frame.vScrollPos - observedWindow->getVScrollPos()) >= 0.1 || observedWindow->getScrollRect() != frame.scrollRect;
+}
+
+// Hand the frame to the next stage, replacing the frame that was waiting there (if any)
+void FigureFinderTask::queueFrame(Stage nextStage, const AnalysisFrame& frame) {
+    if (observedWindow->queueFrame(nextStage, frame)) {
+        QThreadPool::globalInstance()->start(new FigureFinderTask(observedWindow, nextStage));
+    }
+}
+
+// At most one capture of the window runs at a time, and requests made meanwhile are run by the same task once the current capture is done
+// So the analysis mutex is only ever held briefly by the main thread (e.g. while checking whether the window can be deleted)
+void FigureFinderTask::capture() {
+    AnalysisFrame request;
+    while (observedWindow->takeQueuedFrame(Capture, &request)) {
+        observedWindow->getAnalysisMutex().lock();
+        captureFrame();
+        observedWindow->getAnalysisMutex().unlock();
+    }
+}
+
+void FigureFinderTask::captureFrame() {
+    // Before the capture time is updated
+    bool fullDetection = observedWindow->isFullDetectionDue();
+    observedWindow->onCaptureStarted();
 
     bool hasChanged = false;
-    cv::Mat scene = observedWindow->getScreenshot(&hasChanged);
-    double hScrollPos = observedWindow->getHScrollPos();
-    double vScrollPos = observedWindow->getVScrollPos();
-    QRect initialRect = observedWindow->getScrollRect();
+    AnalysisFrame frame;
+    frame.fullDetection = fullDetection;
+    frame.scrollRect = observedWindow->getScrollRect();
+    frame.windowRect = QRect(observedWindow->getX(), observedWindow->getY(), observedWindow->getWidth(), observedWindow->getHeight());
+    frame.sceneRect = frame.windowRect;
 
-    if (!hasChanged && !observedWindow->wasVisible()) {
+    // Figures are in the document, so toolbars and sidebars are neither captured nor analyzed when the document's scroll area is known
+    QRect region;
+    if (Model::getInstance()->analyzeScrollAreaOnly.getValue() && !(frame.scrollRect & frame.windowRect).isEmpty()) {
+        region = frame.sceneRect = frame.scrollRect & frame.windowRect;
+    }
+
+    // SURF only works on luminance, so capturing in grayscale (see FeatureMatchingAlgorithm::toGrayscale) gives the same keypoints with 4 times less pixels' data to move
+    cv::Mat scene = observedWindow->getScreenshot(&hasChanged, &frame.dirtyRects, Model::getInstance()->grayscaleCapture.getValue(), region);
+    frame.hScrollPos = observedWindow->getHScrollPos();
+    frame.vScrollPos = observedWindow->getVScrollPos();
+    frame.sceneSize = scene.size();
+    observedWindow->onFrameCaptured(frame.dirtyRects, frame.sceneSize);
+
+    if (!hasChanged && !observedWindow->wasVisible() && !frame.fullDetection) {
         observedWindow->getAugmentedViewsMutex().lock();
         for (auto augmentedView : observedWindow->getAugmentedViews()) {
             if (augmentedView->isFound() && !augmentedView->isVisible()) {
@@ -87,27 +201,287 @@ void FigureFinderTask::run() {
         }
         observedWindow->getAugmentedViewsMutex().unlock();
     } else if (!scene.empty()) {
-        std::vector<KeyPoint> sceneKeypoints = featureMatchingAlgorithm->detect(scene);
-        Mat sceneDescriptors = featureMatchingAlgorithm->compute(scene, sceneKeypoints);
-        // By the time we reach this line (e.g. after the analysis)  the document might have been modified (e.g. resized, moved, or scrolled) making the results outdated
-        // We detect this by comparing the current scroll position/geometry to the scroll position/geometry when we took the screenshot
-        // If these are different, we just discard the results of the pixel analysis
-        if (qAbs(hScrollPos - observedWindow->getHScrollPos()) < 0.1 && qAbs(vScrollPos - observedWindow->getVScrollPos()) < 0.1 && observedWindow->getScrollRect() == initialRect) {
-            observedWindow->getAugmentedViewsMutex().lock();
-            for (auto augmentedView : observedWindow->getAugmentedViews()) {
-                cv::Rect figureRect;
-                int reason = 0;
-                if (getFigureRect(augmentedView->getReferenceFigure(), sceneKeypoints, sceneDescriptors, &figureRect, &reason)) {
-                    emit augmentedView->figureFound(QRect(figureRect.x, figureRect.y, figureRect.width, figureRect.height));
-                } else {
-                    emit augmentedView->figureNotFound();
+        // The screenshot's memory is released by the next capture, which can now happen before the detection of this frame
+        // The copy is given back to the pool by the detection stage, or made in the memory shared with the analyzer process when it runs
+        if (RemoteAnalyzer::getInstance()->isRunning()) {
+            frame.scene = RemoteAnalyzer::getInstance()->allocateFrame(scene.rows, scene.cols, scene.type());
+        } else {
+            frame.scene = ScreenshotPool::getInstance()->acquire(scene.rows, scene.cols, scene.type());
+        }
+        scene.copyTo(frame.scene);
+        frame.captureId = observedWindow->nextCaptureId();
+        if (Model::getInstance()->maskHiddenRegions.getValue()) {
+            frame.mask = observedWindow->getVisibilityMask(frame.sceneRect, scene.cols, scene.rows);
+        }
+        queueFrame(Detection, frame);
+    }
+
+    // Changes are detected with the tiles' hashes, so the full screenshot is not kept until the next capture
+    observedWindow->clearScreenshotMemory();
+}
+
+void FigureFinderTask::detect() {
+    AnalysisFrame frame;
+    while (observedWindow->takeQueuedFrame(Detection, &frame)) {
+        if (isOutdated(frame)) {
+            continue;
+        }
+
+        int nbTiles = Model::getInstance()->nbDetectionTiles.getValue();
+        featureMatchingAlgorithm->setNbTiles(nbTiles > 0 ? nbTiles : QThread::idealThreadCount());
+
+        // Shifted keypoints are only reused for a few frames in a row, even if the scroll never settles
+        int nbShiftedDetections = observedWindow->getNbShiftedDetections();
+        bool incremental = Model::getInstance()->incrementalScrollDetection.getValue() && !frame.fullDetection && nbShiftedDetections < MAX_SHIFTED_DETECTIONS;
+        bool shifted = incremental && detectIncrementally(frame);
+        bool lazy = false;
+        if (shifted) {
+            nbShiftedDetections++;
+        } else if (!incremental || !detectChangedRegions(frame)) {
+            nbShiftedDetections = 0;
+            if (Model::getInstance()->lazyDescriptors.getValue()) {
+                detectLazily(frame);
+                lazy = true;
+            } else {
+                detectAndCompute(frame, std::vector<Rect>(), frame.keypoints, frame.descriptors);
+            }
+        }
+        observedWindow->setNbShiftedDetections(nbShiftedDetections);
+        bool masked = !frame.mask.empty();
+        ScreenshotPool::getInstance()->release(frame.scene);
+        frame.mask.release();
+        // Keypoints of a masked frame, or of a lazily described one (only near the figures' candidate regions), are incomplete
+        // So they cannot be reused for the next frame
+        // They are not kept either if they take more memory than what a window can retain (the next frame is then fully analyzed)
+        size_t frameBytes = frame.keypoints.size() * sizeof(KeyPoint) + frame.descriptors.total() * frame.descriptors.elemSize();
+        bool retained = frameBytes <= (size_t) Model::getInstance()->windowMemoryBudget.getValue() * 1024;
+        observedWindow->setDetectedFrame(masked || lazy || !retained ? AnalysisFrame() : frame);
+
+        if (!isOutdated(frame)) {
+            queueFrame(Matching, frame);
+        }
+    }
+}
+
+// Keypoints are detected by the analyzer process when it runs (see RemoteAnalyzer), and by this thread otherwise
+// Only the keypoints in *regions* are detected, unless it is empty
+void FigureFinderTask::detectAndCompute(const AnalysisFrame& frame, const std::vector<Rect>& regions, std::vector<KeyPoint>& keypoints, Mat& descriptors) {
+    if (RemoteAnalyzer::getInstance()->detectAndCompute(frame.scene, frame.mask, regions, featureMatchingAlgorithm->getNbTiles(), keypoints, descriptors)) {
+        return;
+    }
+
+    if (regions.empty()) {
+        featureMatchingAlgorithm->detectAndCompute(frame.scene, keypoints, descriptors, frame.mask);
+    } else {
+        featureMatchingAlgorithm->detectAndComputeInRegions(frame.scene, regions, keypoints, descriptors, frame.mask);
+    }
+}
+
+// While scrolling, most of the new frame is the previously detected frame shifted by the scroll delta
+// So instead of analyzing the whole frame, we shift the previous keypoints and only analyze the bands newly exposed by the scroll
+// Returns false if the frame cannot be analyzed this way, in which case it has to be fully analyzed
+bool FigureFinderTask::detectIncrementally(AnalysisFrame& frame) {
+    AnalysisFrame previous = observedWindow->getDetectedFrame();
+
+    if (previous.sceneSize != frame.sceneSize || previous.windowRect != frame.windowRect || previous.scrollRect != frame.scrollRect
+            || previous.sceneRect != frame.sceneRect || frame.scrollRect.isEmpty() || frame.sceneRect.isEmpty() || !frame.mask.empty()) {
+        return false;
+    }
+
+    // The screenshot can have a different resolution than the window (e.g. retina displays)
+    double scaleX = (double) frame.sceneSize.width / frame.sceneRect.width();
+    double scaleY = (double) frame.sceneSize.height / frame.sceneRect.height();
+    int dx = qRound((frame.hScrollPos - previous.hScrollPos) * scaleX);
+    int dy = qRound((frame.vScrollPos - previous.vScrollPos) * scaleY);
+
+    Rect sceneRect(0, 0, frame.sceneSize.width, frame.sceneSize.height);
+    Rect scrollArea = Rect((frame.scrollRect.x() - frame.sceneRect.x()) * scaleX, (frame.scrollRect.y() - frame.sceneRect.y()) * scaleY,
+                           frame.scrollRect.width() * scaleX, frame.scrollRect.height() * scaleY) & sceneRect;
+
+    if ((dx == 0 && dy == 0) || qAbs(dx) >= scrollArea.width / 2 || qAbs(dy) >= scrollArea.height / 2) {
+        return false;
+    }
+
+    // Keypoints can be reused if their descriptor only covered scrolled pixels, both before and after the scroll
+    // Around the scroll area, descriptors mix scrolled and static pixels, so this band is analyzed again too
+    int margin = featureMatchingAlgorithm->getTileOverlap();
+    Rect innerArea(scrollArea.x + margin, scrollArea.y + margin, scrollArea.width - 2 * margin, scrollArea.height - 2 * margin);
+    Rect kept = innerArea & (innerArea - Point(dx, dy));
+    Rect outer = Rect(scrollArea.x - margin, scrollArea.y - margin, scrollArea.width + 2 * margin, scrollArea.height + 2 * margin) & sceneRect;
+
+    if (innerArea.width <= 0 || innerArea.height <= 0 || kept.empty()) {
+        return false;
+    }
+
+    std::vector<KeyPoint> keypoints;
+    Mat descriptors;
+    for (int i = 0; i < (int) previous.keypoints.size(); ++i) {
+        KeyPoint keypoint = previous.keypoints[i];
+        if (!outer.contains(keypoint.pt)) {
+            // Static content around the scroll area (e.g. toolbars)
+            keypoints.push_back(keypoint);
+            descriptors.push_back(previous.descriptors.row(i));
+        } else {
+            keypoint.pt.x -= dx;
+            keypoint.pt.y -= dy;
+            if (kept.contains(keypoint.pt)) {
+                keypoints.push_back(keypoint);
+                descriptors.push_back(previous.descriptors.row(i));
+            }
+        }
+    }
+
+    // Everything in the outer area except the kept part (at most 4 bands)
+    std::vector<Rect> bands;
+    bands.push_back(Rect(outer.x, outer.y, outer.width, kept.y - outer.y));
+    bands.push_back(Rect(outer.x, kept.br().y, outer.width, outer.br().y - kept.br().y));
+    bands.push_back(Rect(outer.x, kept.y, kept.x - outer.x, kept.height));
+    bands.push_back(Rect(kept.br().x, kept.y, outer.br().x - kept.br().x, kept.height));
+
+    std::vector<KeyPoint> bandsKeypoints;
+    Mat bandsDescriptors;
+    detectAndCompute(frame, bands, bandsKeypoints, bandsDescriptors);
+
+    keypoints.insert(keypoints.end(), bandsKeypoints.begin(), bandsKeypoints.end());
+    if (!bandsDescriptors.empty()) {
+        descriptors.push_back(bandsDescriptors);
+    }
+
+    frame.keypoints = keypoints;
+    frame.descriptors = descriptors;
+    return true;
+}
+
+// When the window did not scroll, only the parts that changed since the previous frame (e.g. a cursor, an animation) are analyzed again
+// Returns false if the frame cannot be analyzed this way, in which case it has to be fully analyzed
+bool FigureFinderTask::detectChangedRegions(AnalysisFrame& frame) {
+    AnalysisFrame previous = observedWindow->getDetectedFrame();
+
+    // Dirty rectangles are relative to the previous capture, which must be the frame previously detected
+    if (previous.captureId == 0 || previous.captureId + 1 != frame.captureId || previous.sceneSize != frame.sceneSize
+            || previous.windowRect != frame.windowRect || previous.scrollRect != frame.scrollRect || previous.sceneRect != frame.sceneRect
+            || previous.hScrollPos != frame.hScrollPos || previous.vScrollPos != frame.vScrollPos || !frame.mask.empty()) {
+        return false;
+    }
+
+    // Descriptors of keypoints near a change cover changed pixels, so the regions are grown by the descriptors' extent
+    int margin = featureMatchingAlgorithm->getTileOverlap();
+    Rect sceneRect(0, 0, frame.sceneSize.width, frame.sceneSize.height);
+    std::vector<Rect> regions;
+    for (auto& dirtyRect : frame.dirtyRects) {
+        Rect region = Rect(dirtyRect.x - margin, dirtyRect.y - margin, dirtyRect.width + 2 * margin, dirtyRect.height + 2 * margin) & sceneRect;
+
+        // Grown regions of neighbouring changes overlap, while regions must not overlap to be analyzed separately
+        // So overlapping regions are replaced by their bounding rect, until the region overlaps none of the others
+        bool merged = true;
+        while (merged) {
+            merged = false;
+            for (int i = 0; i < (int) regions.size(); ++i) {
+                if ((regions[i] & region).area() > 0) {
+                    region |= regions[i];
+                    regions.erase(regions.begin() + i);
+                    merged = true;
+                    break;
                 }
             }
-            observedWindow->getAugmentedViewsMutex().unlock();
+        }
+        regions.push_back(region);
+    }
+
+    double dirtyArea = 0;
+    for (auto& region : regions) {
+        dirtyArea += region.area();
+    }
+
+    // Past this point, analyzing the regions separately is not worth it
+    if (dirtyArea > 0.5 * sceneRect.area()) {
+        return false;
+    }
+
+    std::vector<KeyPoint> keypoints;
+    Mat descriptors;
+    for (int i = 0; i < (int) previous.keypoints.size(); ++i) {
+        bool changed = false;
+        for (auto& region : regions) {
+            if (region.contains(previous.keypoints[i].pt)) {
+                changed = true;
+                break;
+            }
+        }
+        if (!changed) {
+            keypoints.push_back(previous.keypoints[i]);
+            descriptors.push_back(previous.descriptors.row(i));
         }
     }
 
-    observedWindow->getAnalysisMutex().unlock();
+    if (!regions.empty()) {
+        std::vector<KeyPoint> regionsKeypoints;
+        Mat regionsDescriptors;
+        detectAndCompute(frame, regions, regionsKeypoints, regionsDescriptors);
+
+        keypoints.insert(keypoints.end(), regionsKeypoints.begin(), regionsKeypoints.end());
+        if (!regionsDescriptors.empty()) {
+            descriptors.push_back(regionsDescriptors);
+        }
+    }
+
+    frame.keypoints = keypoints;
+    frame.descriptors = descriptors;
+    return true;
+}
+
+// Describing keypoints is the most expensive part of the analysis, and most of them are far from any figure
+// So we first only detect the keypoints, look for regions where their layout looks like the one of a figure of the window,
+// and only describe the keypoints inside these regions
+void FigureFinderTask::detectLazily(AnalysisFrame& frame) {
+    std::vector<KeyPoint> keypoints;
+    Mat noDescriptors;
+    featureMatchingAlgorithm->detectAndCompute(frame.scene, keypoints, noDescriptors, frame.mask, false);
+
+    std::vector<Rect> regions;
+    observedWindow->getAugmentedViewsMutex().lock();
+    for (auto augmentedView : observedWindow->getAugmentedViews()) {
+        Figure* figure = augmentedView->getReferenceFigure();
+        std::vector<Rect> figureRegions = featureMatchingAlgorithm->findCandidateRegions(figure->getWidth(), figure->getHeight(), figure->getKeypoints(), keypoints, frame.sceneSize);
+        regions.insert(regions.end(), figureRegions.begin(), figureRegions.end());
+    }
+    observedWindow->getAugmentedViewsMutex().unlock();
+
+    frame.keypoints.clear();
+    for (auto& keypoint : keypoints) {
+        for (auto& region : regions) {
+            if (region.contains(keypoint.pt)) {
+                frame.keypoints.push_back(keypoint);
+                break;
+            }
+        }
+    }
+
+    frame.descriptors = Mat();
+    if (!frame.keypoints.empty()) {
+        frame.descriptors = featureMatchingAlgorithm->compute(frame.scene, frame.keypoints);
+    }
+}
+
+void FigureFinderTask::match() {
+    AnalysisFrame frame;
+    while (observedWindow->takeQueuedFrame(Matching, &frame)) {
+        if (isOutdated(frame)) {
+            continue;
+        }
+
+        observedWindow->getAugmentedViewsMutex().lock();
+        for (auto augmentedView : observedWindow->getAugmentedViews()) {
+            cv::Rect figureRect;
+            int reason = 0;
+            if (getFigureRect(augmentedView->getReferenceFigure(), frame.keypoints, frame.descriptors, frame.sceneRect.topLeft(), &figureRect, &reason)) {
+                emit augmentedView->figureFound(QRect(figureRect.x, figureRect.y, figureRect.width, figureRect.height));
+            } else {
+                emit augmentedView->figureNotFound();
+            }
+        }
+        observedWindow->getAugmentedViewsMutex().unlock();
+    }
 }
 
 FigureFinderTask::~FigureFinderTask() {
@@ -19,26 +19,65 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #define FIGUREFINDERTASK_H
 
 #include <QRunnable>
+#include <QRect>
 #include <vector>
 #include <opencv2/opencv.hpp>
 
 class Figure;
 class ObservedWindow;
 class FeatureMatchingAlgorithm;
+struct MatchingStats;
+
+// A frame going through the analysis pipeline (capture -> detection -> matching)
+struct AnalysisFrame {
+    cv::Mat scene;
+    cv::Mat mask; // Parts of the scene hidden by other windows (empty if fully visible)
+    cv::Size sceneSize;
+    double hScrollPos;
+    double vScrollPos;
+    QRect scrollRect;
+    QRect windowRect;
+    QRect sceneRect; // Part of the screen covered by the scene (the window, or only its scroll area)
+    std::vector<cv::Rect> dirtyRects; // Parts of the scene that changed since the previous frame
+    bool fullDetection; // The keypoints of the previous frame must not be reused (see ObservedWindow::isFullDetectionDue)
+    unsigned int captureId; // Consecutive for frames captured one after the other (0 if none)
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+
+    AnalysisFrame() : hScrollPos(0), vScrollPos(0), fullDetection(false), captureId(0) {}
+};
 
 class FigureFinderTask : public QRunnable
 {
 public:
-    FigureFinderTask(ObservedWindow* observedWindow);
+    // The stages run in different tasks so that the capture of frame N+1 overlaps with the detection of frame N and the matching of frame N-1
+    enum Stage {Capture, Detection, Matching};
+
+    FigureFinderTask(ObservedWindow* observedWindow, Stage stage = Capture);
     void run();
-    bool getFigureRect(Figure* figure, std::vector<cv::KeyPoint>& sceneKeypoints, cv::Mat& sceneDescriptors, cv::Rect* figureRect, int* reason);
+    bool getFigureRect(Figure* figure, std::vector<cv::KeyPoint>& sceneKeypoints, cv::Mat& sceneDescriptors, QPoint sceneOrigin, cv::Rect* figureRect, int* reason);
     ~FigureFinderTask();
 
     static FeatureMatchingAlgorithm* featureMatchingAlgorithm;
+    static FeatureMatchingAlgorithm* createFeatureMatchingAlgorithm();
 
 
 private:
-   ObservedWindow* observedWindow;
+    void capture();
+    void captureFrame();
+    void detect();
+    void match();
+    void detectAndCompute(const AnalysisFrame& frame, const std::vector<cv::Rect>& regions, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors);
+    bool detectIncrementally(AnalysisFrame& frame);
+    bool detectChangedRegions(AnalysisFrame& frame);
+    void detectLazily(AnalysisFrame& frame);
+    bool isOutdated(const AnalysisFrame& frame);
+    cv::Rect locateFigure(Figure* figure, double distanceThreshold, int nbAssociationsMax, std::vector<cv::KeyPoint>& sceneKeypoints, cv::Mat& sceneDescriptors, MatchingStats* stats);
+    static bool hasAspectRatioOf(Figure* figure, cv::Rect rect);
+    void queueFrame(Stage nextStage, const AnalysisFrame& frame);
+
+    ObservedWindow* observedWindow;
+    Stage stage;
 };
 
 #endif // FIGUREFINDERTASK_H
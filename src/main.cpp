@@ -26,13 +26,36 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include <QMessageBox>
 #include <QDir>
 #include <QStandardPaths>
+#include <QCommandLineParser>
+#include <QDirIterator>
+#include <QImage>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QThreadPool>
 #include "demodialog.h"
+#include "figurefindertask.h"
+#include "algorithms/featurematchingalgorithm.h"
+#include "autotuner.h"
+#include "model/model.h"
+#include "model/configuration.h"
+#include "trace.h"
+#include "remoteanalyzer.h"
+#ifdef CHAMELEON_REPLAY
+#include "os_specific/replay/replay.h"
+#endif
 
 Database* database;
 ObservedWindowsManager* windowManager;
 ObservedFilesManager* filesManager;
 
 void onFileOpened(const char* filePath, processId id) {
+    if (TraceRecorder::getInstance()->isRecording()) {
+        TraceEvent event(FileOpened);
+        event.pid = id;
+        event.text = filePath;
+        TraceRecorder::getInstance()->record(event);
+    }
+
     QList<Figure*> figures = database->getFiguresOfFile(filePath);
 
     if (!figures.isEmpty()) {
@@ -43,18 +66,62 @@ void onFileOpened(const char* filePath, processId id) {
 }
 
 void onWindowDestroyed(windowId id) {
+    if (TraceRecorder::getInstance()->isRecording()) {
+        TraceEvent event(WindowDestroyed);
+        event.wid = id;
+        TraceRecorder::getInstance()->record(event);
+    }
+
     windowManager->onWindowDestroyed(id);
 }
 
 void onWindowUpdated(windowId wid, processId pid, int x, int y, int width, int height, bool isOnScreen, const char* title, bool isFrontMost) {
+    if (TraceRecorder::getInstance()->isRecording()) {
+        TraceEvent event(WindowUpdated);
+        event.wid = wid;
+        event.pid = pid;
+        event.rect = QRect(x, y, width, height);
+        event.isOnScreen = isOnScreen;
+        event.isFrontMost = isFrontMost;
+        event.text = title;
+        TraceRecorder::getInstance()->record(event);
+    }
+
     windowManager->onWindowUpdated(wid, pid, x, y, width, height, isOnScreen, title, isFrontMost);
 }
 
-void onWindowScrolled(windowId wid, int x, int y, int width, int height, double horizontalPos, double verticalPos) {
-    windowManager->onWindowScrolled(wid, x, y, width, height, horizontalPos, verticalPos);
+void onWindowScrolled(windowId wid, unsigned long scrollAreaId, int x, int y, int width, int height, double horizontalPos, double verticalPos) {
+    if (TraceRecorder::getInstance()->isRecording()) {
+        TraceEvent event(WindowScrolled);
+        event.wid = wid;
+        event.scrollAreaId = scrollAreaId;
+        event.rect = QRect(x, y, width, height);
+        event.horizontalPos = horizontalPos;
+        event.verticalPos = verticalPos;
+        TraceRecorder::getInstance()->record(event);
+    }
+
+    windowManager->onWindowScrolled(wid, scrollAreaId, x, y, width, height, horizontalPos, verticalPos);
+}
+
+void onWindowDamaged(windowId wid, int x, int y, int width, int height) {
+    if (TraceRecorder::getInstance()->isRecording()) {
+        TraceEvent event(WindowDamaged);
+        event.wid = wid;
+        event.rect = QRect(x, y, width, height);
+        TraceRecorder::getInstance()->record(event);
+    }
+
+    windowManager->onWindowDamaged(wid, x, y, width, height);
 }
 
 void onMouseMoved(int x, int y) {
+    if (TraceRecorder::getInstance()->isRecording()) {
+        TraceEvent event(MouseMoved);
+        event.rect = QRect(x, y, 1, 1);
+        TraceRecorder::getInstance()->record(event);
+    }
+
     windowManager->dispatchMouseMovedEvent(x, y);
 }
 
@@ -92,16 +159,208 @@ void customMessageOutput(QtMsgType type, const QMessageLogContext &context, cons
         fclose(output);
     }
 }
+// Build the stop-features from the images of plain document pages found in *pagesDirectory*
+// (e.g. test/chameleon_paper.pdf rendered with "pdftoppm -png -r 72 chameleon_paper.pdf pages/page")
+bool buildStopFeatures(QString pagesDirectory, QString outputPath) {
+    std::vector<Mat> pagesDescriptors;
+    QDirIterator it(pagesDirectory, QStringList() << "*.png" << "*.jpg" << "*.jpeg", QDir::Files);
+
+    while (it.hasNext()) {
+        QImage page = QImage(it.next()).convertToFormat(QImage::Format_RGBA8888);
+        if (page.isNull()) {
+            continue;
+        }
+
+        cv::Mat pageMat(page.height(), page.width(), CV_8UC4, (void *) page.constBits(), page.bytesPerLine());
+        std::vector<KeyPoint> keypoints;
+        Mat descriptors;
+        FigureFinderTask::featureMatchingAlgorithm->detectAndCompute(pageMat, keypoints, descriptors);
+        if (!descriptors.empty()) {
+            pagesDescriptors.push_back(descriptors);
+        }
+    }
+
+    if (pagesDescriptors.empty()) {
+        qWarning() << "No page image found in" << pagesDirectory;
+        return false;
+    }
+
+    Mat allDescriptors;
+    vconcat(pagesDescriptors, allDescriptors);
+
+    StopFeatures stopFeatures;
+    stopFeatures.build(allDescriptors);
+    return !stopFeatures.isEmpty() && stopFeatures.save(outputPath);
+}
+
+// Search the parameters on the labeled corpus in *corpusDirectory*, print the latency/recall Pareto front
+// and save the fastest configuration reaching *targetRecall* so that it is used from the next start
+bool tune(QString corpusDirectory, double targetRecall, QString outputPath) {
+    AutoTuner tuner;
+    if (!tuner.loadCorpus(corpusDirectory)) {
+        qWarning() << "No labeled sample found in" << corpusDirectory;
+        return false;
+    }
+    tuner.run();
+
+    QTextStream out(stdout);
+    out << "Pareto front (latency / recall / false positives):" << "\n";
+    for (TuningResult& result : tuner.getParetoFront()) {
+        out << QString("%1 ms\t%2\t%3\t%4, distanceThreshold %5, nbAssociationsMax %6")
+               .arg(result.latency, 0, 'f', 1).arg(result.recall, 0, 'f', 3).arg(result.falsePositiveRate, 0, 'f', 3)
+               .arg(result.engine).arg(result.distanceThreshold).arg(result.nbAssociationsMax) << "\n";
+    }
+
+    TuningResult best;
+    if (!tuner.recommend(targetRecall, 0.05, &best)) {
+        out << "No configuration reaches a recall of " << targetRecall << ", using the one with the best recall" << "\n";
+    }
+    out << "Recommended: " << best.engine << ", distanceThreshold " << best.distanceThreshold << ", nbAssociationsMax " << best.nbAssociationsMax << " (" << best.latency << " ms, recall " << best.recall << ")" << "\n";
+
+    // The features of the new parameters can only be computed for the figures whose image is stored
+    int nbFiguresWithoutFeatures = Database().countFiguresWithoutFeatures(best.engine);
+    if (nbFiguresWithoutFeatures > 0) {
+        qWarning() << nbFiguresWithoutFeatures << "figures were registered without their image, they will be matched with features of other parameters (less reliably) until registered again";
+    }
+
+    Model* model = Model::getInstance();
+    model->surfHessianThreshold.setValue(best.hessianThreshold);
+    model->surfNbOctaves.setValue(best.nbOctaves);
+    model->surfNbOctaveLayers.setValue(best.nbOctaveLayers);
+    model->distanceThreshold.setValue(best.distanceThreshold);
+    model->nbAssociationsMax.setValue(best.nbAssociationsMax);
+    return saveConfiguration(outputPath);
+}
+
+// Capture *windowId* (the active window if 0) *nbCaptures* times, in color and in grayscale, and print the throughput
+// Meant to compare the platform backends, e.g. on Linux under Xvfb: Xvfb :99 & DISPLAY=:99 xterm & DISPLAY=:99 Chameleon --benchmark-capture 0
+bool benchmarkCapture(windowId wid, int nbCaptures) {
+    initialize();
+    if (wid == 0) {
+        wid = getActiveWindow();
+    }
+
+    QTextStream out(stdout);
+    for (bool grayscale : {false, true}) {
+        QElapsedTimer timer;
+        timer.start();
+        qint64 nbBytes = 0;
+        for (int i = 0; i < nbCaptures; ++i) {
+            screenshot capture = captureScreenshot(wid, grayscale);
+            if (!capture.width || !capture.height) {
+                qWarning() << "Cannot capture window" << wid;
+                return false;
+            }
+            nbBytes += capture.width * capture.height * capture.bits_per_pixels / 8;
+            clearCapturedScreenshotMemory(capture);
+        }
+
+        double seconds = timer.nsecsElapsed() / 1e9;
+        out << (grayscale ? "Grayscale: " : "Color: ") << nbCaptures / seconds << " captures/s, " << nbBytes / seconds / (1024 * 1024) << " MB/s" << "\n";
+    }
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
     startTime = std::chrono::steady_clock::now();
     qInstallMessageHandler(customMessageOutput);
+
+    // The analyzer process started by RemoteAnalyzer has no interface (Chameleon --analyzer <server> --analyzer-memory <descriptor>)
+    if (argc == 5 && QString(argv[1]) == "--analyzer") {
+        QCoreApplication analyzer(argc, argv);
+        analyzer.setOrganizationDomain("Loki");
+        analyzer.setApplicationName("Chameleon");
+        if (loadConfiguration(getConfigurationPath())) {
+            delete FigureFinderTask::featureMatchingAlgorithm;
+            FigureFinderTask::featureMatchingAlgorithm = FigureFinderTask::createFeatureMatchingAlgorithm();
+        }
+        return runAnalyzer(argv[2], QString(argv[4]).toInt());
+    }
+
     QApplication a(argc, argv);
     a.setOrganizationDomain("Loki");
     a.setApplicationName("Chameleon");
 
     a.setQuitOnLastWindowClosed(false);
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption buildStopFeaturesOption("build-stop-features", "Build the stop-features from the images of document pages in <directory>, then exit.", "directory");
+    QCommandLineOption pruneStopFeaturesOption("prune-stop-features", "Remove the stop-features from the figures already registered, then exit.");
+    QCommandLineOption tuneOption("tune", "Search the detection and matching parameters on the labeled corpus in <directory> and save the recommended configuration, then exit.", "directory");
+    QCommandLineOption tuneRecallOption("tune-recall", "Recall that the configuration recommended by --tune must reach (default 0.95).", "ratio", "0.95");
+    parser.addOption(buildStopFeaturesOption);
+    parser.addOption(pruneStopFeaturesOption);
+    QCommandLineOption benchmarkCaptureOption("benchmark-capture", "Measure the capture throughput of the window <id> (0 for the active window), then exit.", "id");
+    parser.addOption(tuneOption);
+    parser.addOption(tuneRecallOption);
+    parser.addOption(benchmarkCaptureOption);
+    QCommandLineOption recordOption("record", "Record what the system reports and the screenshots of the analyzed windows to the trace <file>, to replay the session with a replay build (qmake CONFIG+=replay).", "file");
+    parser.addOption(recordOption);
+    QCommandLineOption analyzerProcessOption("analyzer-process", "Detect the keypoints of the analyzed windows in a separate process with a lower priority.");
+    parser.addOption(analyzerProcessOption);
+#ifdef CHAMELEON_REPLAY
+    QCommandLineOption replayOption("replay", "Replay the trace <file> instead of observing the desktop.", "file");
+    QCommandLineOption replaySpeedOption("replay-speed", "Replay the trace <factor> times faster than it was recorded (default 1).", "factor", "1");
+    parser.addOption(replayOption);
+    parser.addOption(replaySpeedOption);
+#endif
+    parser.process(a);
+
+    if (parser.isSet(benchmarkCaptureOption)) {
+        return benchmarkCapture(parser.value(benchmarkCaptureOption).toUInt(), 200) ? 0 : 1;
+    }
+
+    if (parser.isSet(tuneOption)) {
+        return tune(parser.value(tuneOption), parser.value(tuneRecallOption).toDouble(), getConfigurationPath()) ? 0 : 1;
+    }
+
+    // The algorithm must be created with the tuned parameters before any figure is loaded
+    if (loadConfiguration(getConfigurationPath())) {
+        qDebug() << "Configuration loaded";
+        delete FigureFinderTask::featureMatchingAlgorithm;
+        FigureFinderTask::featureMatchingAlgorithm = FigureFinderTask::createFeatureMatchingAlgorithm();
+    }
+
+    if (parser.isSet(buildStopFeaturesOption) || parser.isSet(pruneStopFeaturesOption)) {
+        database = new Database();
+
+        if (parser.isSet(buildStopFeaturesOption) && !buildStopFeatures(parser.value(buildStopFeaturesOption), database->getStopFeaturesPath())) {
+            return 1;
+        }
+
+        if (parser.isSet(pruneStopFeaturesOption)) {
+            database->load();
+            // load() computes the missing features in the background, they must be stored before pruning and exiting
+            QThreadPool::globalInstance()->waitForDone();
+            qDebug() << database->pruneStopFeatures() << "keypoints removed from the database";
+        }
+        return 0;
+    }
+
+#ifdef CHAMELEON_REPLAY
+    double replaySpeed = parser.value(replaySpeedOption).toDouble();
+    if (!parser.isSet(replayOption) || !loadReplayTrace(parser.value(replayOption), replaySpeed)) {
+        qWarning() << "This build replays a recorded session, a trace is required (--replay <file>)";
+        return 1;
+    }
+    // The windows are analyzed as often as during the recording, relatively to the replayed time
+    if (replaySpeed > 0) {
+        Model* model = Model::getInstance();
+        model->timeBetweenUpdates.setValue(qMax(1, qRound(model->timeBetweenUpdates.getValue() / replaySpeed)));
+        model->minTimeBetweenAnalyses.setValue(qMax(1, qRound(model->minTimeBetweenAnalyses.getValue() / replaySpeed)));
+        model->maxTimeBetweenAnalyses.setValue(qMax(1, qRound(model->maxTimeBetweenAnalyses.getValue() / replaySpeed)));
+    }
+#endif
+
+    if (parser.isSet(recordOption)) {
+        if (!TraceRecorder::getInstance()->start(parser.value(recordOption))) {
+            return 1;
+        }
+        QObject::connect(&a, &QCoreApplication::aboutToQuit, []() {TraceRecorder::getInstance()->stop();});
+    }
+
     bool screenCapture = requestScreenCapturePermission();
     bool accessibility = requestAccessibilityPermission();
 
@@ -121,8 +380,23 @@ int main(int argc, char *argv[])
         database->load();
     }
 
+    if (parser.isSet(analyzerProcessOption)) {
+        Model::getInstance()->outOfProcessAnalysis.setValue(true);
+    }
+    if (Model::getInstance()->outOfProcessAnalysis.getValue()) {
+        RemoteAnalyzer::getInstance()->start();
+    }
+    Model::getInstance()->outOfProcessAnalysis.addCallbackOnChange([](bool& enabled) {
+        if (enabled) {
+            RemoteAnalyzer::getInstance()->start();
+        } else {
+            RemoteAnalyzer::getInstance()->stop();
+        }
+    });
+    QObject::connect(&a, &QCoreApplication::aboutToQuit, []() {RemoteAnalyzer::getInstance()->stop();});
+
     initialize();
-    windowManager = new ObservedWindowsManager;
+    windowManager = new ObservedWindowsManager(database);
     filesManager = new ObservedFilesManager(database);
     MainWindow w(database, windowManager, filesManager);
     setActivationEnabled(false);
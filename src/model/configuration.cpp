@@ -0,0 +1,56 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include "model/configuration.h"
+#include "model/model.h"
+#include <QSettings>
+#include <QStandardPaths>
+#include <QFile>
+#include <QDir>
+
+QString getConfigurationPath() {
+    QString location = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(location);
+    return location + "/config.ini";
+}
+
+bool loadConfiguration(QString path) {
+    if (!QFile::exists(path)) {
+        return false;
+    }
+
+    QSettings settings(path, QSettings::IniFormat);
+    Model* model = Model::getInstance();
+    model->surfHessianThreshold.setValue(settings.value("surf/hessianThreshold", model->surfHessianThreshold.getValue()).toDouble());
+    model->surfNbOctaves.setValue(settings.value("surf/nbOctaves", model->surfNbOctaves.getValue()).toInt());
+    model->surfNbOctaveLayers.setValue(settings.value("surf/nbOctaveLayers", model->surfNbOctaveLayers.getValue()).toInt());
+    model->distanceThreshold.setValue(settings.value("matching/distanceThreshold", model->distanceThreshold.getValue()).toDouble());
+    model->nbAssociationsMax.setValue(settings.value("matching/nbAssociationsMax", model->nbAssociationsMax.getValue()).toInt());
+    return settings.status() == QSettings::NoError;
+}
+
+bool saveConfiguration(QString path) {
+    QSettings settings(path, QSettings::IniFormat);
+    Model* model = Model::getInstance();
+    settings.setValue("surf/hessianThreshold", model->surfHessianThreshold.getValue());
+    settings.setValue("surf/nbOctaves", model->surfNbOctaves.getValue());
+    settings.setValue("surf/nbOctaveLayers", model->surfNbOctaveLayers.getValue());
+    settings.setValue("matching/distanceThreshold", model->distanceThreshold.getValue());
+    settings.setValue("matching/nbAssociationsMax", model->nbAssociationsMax.getValue());
+    settings.sync();
+    return settings.status() == QSettings::NoError;
+}
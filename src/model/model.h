@@ -30,13 +30,33 @@ private:
 
     Model() :
       timeBetweenUpdates(1000),
+      minTimeBetweenAnalyses(100),
+      maxTimeBetweenAnalyses(4000),
+      damageDrivenAnalysis(true),
+      grayscaleCapture(true),
+      analyzeScrollAreaOnly(true),
+      windowMemoryBudget(4096),
+      surfHessianThreshold(300),
+      surfNbOctaves(2),
+      surfNbOctaveLayers(3),
       distanceThreshold(0.098),
       nbAssociationsMax(1000),
+      nbDetectionTiles(0),
+      outOfProcessAnalysis(false),
+      maskHiddenRegions(true),
+      incrementalScrollDetection(true),
+      progressiveMatching(true),
+      progressiveMinInliers(12),
+      progressiveMinConsensus(0.6),
+      lazyDescriptors(false),
+      calibrateFigureThresholds(true),
+      maxFigureKeypoints(500),
       showInfoButton(true),
       redirectAugmentedView(false),
       useAccessibility(true),
       onlyAnalyzeActiveWindow(true),
-      useDtrace(false)
+      useDtrace(false),
+      identifyDocumentsVisually(true)
     {}
 
 public:
@@ -49,14 +69,34 @@ public:
     }
 
 
-    Observable<int> timeBetweenUpdates;
+    Observable<int> timeBetweenUpdates; // Refresh of the list of windows, each window being analyzed according to its activity (see ObservedWindow::isCaptureDue)
+    Observable<int> minTimeBetweenAnalyses; // Interval between two captures of a window whose content keeps changing
+    Observable<int> maxTimeBetweenAnalyses; // Interval between two captures of a window whose content does not change
+    Observable<bool> damageDrivenAnalysis; // Only capture a window when the system reports it was redrawn, instead of every timeBetweenUpdates (X11 only)
+    Observable<bool> grayscaleCapture; // Capture the analyzed windows in 8 bits luminance instead of RGBA
+    Observable<bool> analyzeScrollAreaOnly; // Only capture and analyze the document's scroll area (when known through accessibility)
+    Observable<int> windowMemoryBudget; // KB of analysis results kept per window between two frames (0 to only keep the tiles' hashes)
+    Observable<double> surfHessianThreshold; // SURF parameters are only read at startup (see config.ini written by Chameleon --tune)
+    Observable<int> surfNbOctaves;
+    Observable<int> surfNbOctaveLayers;
     Observable<double> distanceThreshold;
     Observable<int> nbAssociationsMax;
+    Observable<int> nbDetectionTiles; // 0 to use one tile per core
+    Observable<bool> outOfProcessAnalysis; // Detect the keypoints in a separate process with a lower priority (see RemoteAnalyzer)
+    Observable<bool> maskHiddenRegions;
+    Observable<bool> incrementalScrollDetection;
+    Observable<bool> progressiveMatching;
+    Observable<int> progressiveMinInliers;
+    Observable<double> progressiveMinConsensus; // Minimum ratio of inliers among the matches used
+    Observable<bool> lazyDescriptors; // Only describe keypoints in regions whose keypoint layout looks like a figure
+    Observable<bool> calibrateFigureThresholds; // Learn per-figure matching thresholds from past detections
+    Observable<int> maxFigureKeypoints; // Keypoints stored when registering a figure (0 to keep them all)
     Observable<bool> showInfoButton;
     Observable<bool> redirectAugmentedView;
     Observable<bool> useAccessibility;
     Observable<bool> onlyAnalyzeActiveWindow;
     Observable<bool> useDtrace;
+    Observable<bool> identifyDocumentsVisually; // Recognize the document of focused windows whose file is unknown
 };
 
 #endif // MODEL_H
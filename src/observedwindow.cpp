@@ -18,13 +18,29 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include "observedwindow.h"
 #include "figure.h"
 #include "os_specific/window.h"
+#include "trace.h"
 #include <QThread>
 #include <QDebug>
 #include <QDateTime>
+#include <QtMath>
+#include "model/model.h"
+
+// Past this number, the parts of the window redrawn since the last capture are merged together
+#define MAX_DAMAGE_RECTS 32
+// Scroll and resize events come in bursts, and frames captured in between would be outdated before being analyzed
+#define INTERACTION_SETTLE_MSECS 150
+// Below this part of the window redrawn, the change is considered as noise (e.g. a blinking caret or a clock) and does not speed up the captures
+#define MIN_ACTIVITY_AREA_RATIO 0.02
 
 ObservedWindow::ObservedWindow(processId pid, windowId wid) :
     pid(pid), wid(wid) {
     hasScreenshot = false;
+    lastCaptureId = 0;
+    lastCaptureTime = 0;
+    captureInterval = Model::getInstance()->minTimeBetweenAnalyses.getValue();
+    nbShiftedDetections = 0;
+    lastGeometryChangeTime = 0;
+    damageReported = false;
     hasMoved = false;
     title[0] = 0;
     lastVisible = false;
@@ -32,6 +48,11 @@ ObservedWindow::ObservedWindow(processId pid, windowId wid) :
     hasScrollPos = false;
     lastScrollTime = 0;
     frontMost = false;
+
+    for (int stage = FigureFinderTask::Capture; stage <= FigureFinderTask::Matching; ++stage) {
+        hasQueuedFrame[stage] = false;
+        stageRunning[stage] = false;
+    }
 }
 
 // Add a new figure to look for in the window
@@ -49,57 +70,164 @@ void ObservedWindow::addFigure(Figure* figure) {
     augmentedViewsMutex.unlock();
 }
 
-void ObservedWindow::onWindowScrolled(QRect scrollRect, double horizontalPos, double verticalPos) {
-    // TODO : Handle multiple scrollArea in the same window
+// A window can have several scroll areas (e.g. a sidebar with the pages' thumbnails next to the document)
+// Augmented views only follow the scroll area they are in, and the largest area is considered to be the document
+void ObservedWindow::onWindowScrolled(unsigned long scrollAreaId, QRect scrollRect, double horizontalPos, double verticalPos) {
     augmentedViewsMutex.lock();
-    if (hasScrollPos) {
-        double scrollDeltaX = horizontalPos - lastHorizontalScrollPos;
-        double scrollDeltaY = verticalPos - lastVerticalScrollPos;
-        double canvasDeltaX = scrollRect.x() - lastScrollRect.x();
-        double canvasDeltaY = scrollRect.y() - lastScrollRect.y();
+    int index = -1;
+    for (int i = 0; i < scrollAreas.size(); ++i) {
+        if (scrollAreas.at(i).id == scrollAreaId) {
+            index = i;
+            break;
+        }
+    }
+
+    if (index >= 0) {
+        ScrollArea& area = scrollAreas[index];
+        double scrollDeltaX = horizontalPos - area.horizontalPos;
+        double scrollDeltaY = verticalPos - area.verticalPos;
+        double canvasDeltaX = scrollRect.x() - area.rect.x();
+        double canvasDeltaY = scrollRect.y() - area.rect.y();
         double deltaX = scrollDeltaX - canvasDeltaX;
         double deltaY = scrollDeltaY - canvasDeltaY;
 
         if (deltaX != 0 || deltaY != 0) {
             for (auto augmentedView : augmentedViews) {
-                augmentedView->moveInsideRect(scrollRect, augmentedView->getX() - deltaX, augmentedView->getY() - deltaY);
+                if (getScrollAreaOf(augmentedView) == index) {
+                    augmentedView->moveInsideRect(scrollRect, augmentedView->getX() - deltaX, augmentedView->getY() - deltaY);
+                }
             }
         }
+    } else {
+        index = scrollAreas.size();
+        scrollAreas.append(ScrollArea());
+        scrollAreas[index].id = scrollAreaId;
+    }
+
+    scrollAreas[index].rect = scrollRect;
+    scrollAreas[index].horizontalPos = horizontalPos;
+    scrollAreas[index].verticalPos = verticalPos;
+
+    int mainArea = 0;
+    for (int i = 1; i < scrollAreas.size(); ++i) {
+        QRect rect = scrollAreas.at(i).rect;
+        QRect mainRect = scrollAreas.at(mainArea).rect;
+        if (rect.width() * rect.height() > mainRect.width() * mainRect.height()) {
+            mainArea = i;
+        }
     }
 
-    lastHorizontalScrollPos = horizontalPos;
-    lastVerticalScrollPos = verticalPos;
-    lastScrollRect = scrollRect;
+    lastHorizontalScrollPos = scrollAreas.at(mainArea).horizontalPos;
+    lastVerticalScrollPos = scrollAreas.at(mainArea).verticalPos;
+    lastScrollRect = scrollAreas.at(mainArea).rect;
+    lastScrollWindowRect = QRect(x, y, width, height);
     hasScrollPos = true;
     lastScrollTime = QDateTime::currentMSecsSinceEpoch();
     augmentedViewsMutex.unlock();
 }
 
+// Index of the scroll area containing *augmentedView*: the one sharing the most columns with it
+// Views scrolled out of their area are still vertically aligned with it, hence only the columns are compared
+int ObservedWindow::getScrollAreaOf(AugmentedView* augmentedView) {
+    int index = -1;
+    int maxOverlap = 0;
+    int viewLeft = qRound(augmentedView->getX());
+    int viewRight = viewLeft + augmentedView->getVirtualWidth();
+
+    for (int i = 0; i < scrollAreas.size(); ++i) {
+        QRect rect = scrollAreas.at(i).rect;
+        int overlap = qMin(viewRight, rect.x() + rect.width()) - qMax(viewLeft, rect.x());
+        if (overlap > maxOverlap) {
+            maxOverlap = overlap;
+            index = i;
+        }
+    }
+
+    return index;
+}
+
+// Queue a frame to be analyzed by *stage*. A frame already waiting for this stage is stale and gets dropped
+// Returns true if no task is running this stage, in which case the caller has to start one
+bool ObservedWindow::queueFrame(FigureFinderTask::Stage stage, const AnalysisFrame& frame) {
+    pipelineMutex.lock();
+    queuedFrames[stage] = frame;
+    hasQueuedFrame[stage] = true;
+    bool shouldStart = !stageRunning[stage];
+    stageRunning[stage] = true;
+    pipelineMutex.unlock();
+
+    return shouldStart;
+}
+
+// Take the frame waiting for *stage*
+// Returns false when there is none, in which case the stage is considered idle again
+bool ObservedWindow::takeQueuedFrame(FigureFinderTask::Stage stage, AnalysisFrame* frame) {
+    pipelineMutex.lock();
+    bool hasFrame = hasQueuedFrame[stage];
+    if (hasFrame) {
+        *frame = queuedFrames[stage];
+        queuedFrames[stage] = AnalysisFrame();
+        hasQueuedFrame[stage] = false;
+    } else {
+        stageRunning[stage] = false;
+    }
+    pipelineMutex.unlock();
+
+    return hasFrame;
+}
+
+// Test if this window is still being captured or analyzed (or waiting to be)
+bool ObservedWindow::isAnalysisPending() {
+    pipelineMutex.lock();
+    bool pending = stageRunning[FigureFinderTask::Capture] || stageRunning[FigureFinderTask::Detection] || stageRunning[FigureFinderTask::Matching];
+    pipelineMutex.unlock();
+
+    return pending;
+}
+
 // Capture a screenshot of the window and then return it
 // *hasChanged* will be set to true if the screenshot is different from the previous call to this method
-cv::Mat ObservedWindow::getScreenshot(bool* hasChanged) {
-    screenshot capture = captureScreenshot(wid);
+// The returned image is only valid until clearScreenshotMemory() or the next call, which release its memory
+cv::Mat ObservedWindow::getScreenshot(bool* hasChanged, std::vector<cv::Rect>* dirtyRects, bool grayscale, QRect region) {
+    // Damage is taken before capturing: a part redrawn during the capture might not be in the screenshot, so it is left for the next capture
+    QList<QRect> capturedDamage;
+    if (damageReported && hasChanged != NULL) {
+        capturedDamage = takeDamage();
+    }
+
+    // Only the *region* of the screen is captured if specified
+    screenshot capture = captureScreenshot(wid, grayscale, region.x(), region.y(), region.width(), region.height());
 
     if (capture.width && capture.height) {
-        cv::Mat newScreen = cv::Mat(capture.height, capture.width, capture.bits_per_pixels > 24 ? CV_8UC4 : CV_8UC3, capture.pixels);
+        cv::Mat newScreen = cv::Mat(capture.height, capture.width, capture.bits_per_pixels > 24 ? CV_8UC4 : (capture.bits_per_pixels > 8 ? CV_8UC3 : CV_8UC1), capture.pixels);
 
         if (hasChanged != NULL) {
-            *hasChanged = true;
-        }
+            std::vector<cv::Rect> changes;
+            if (damageReported) {
+                // The system told us what was redrawn, no need to look at the pixels. The hashes would be outdated once it stops
+                changes = damageToSceneRects(capturedDamage, region.isEmpty() ? QRect(x, y, width, height) : region, newScreen.size());
+                changeDetector.reset();
+            } else {
+                // Compare the tiles' hashes of the previous screenshot with the ones of the new screenshot, the previous pixels are not needed
+                changes = changeDetector.update(newScreen);
+            }
+            if (hasMoved) {
+                hasMoved = false;
+                changes.assign(1, cv::Rect(0, 0, newScreen.cols, newScreen.rows));
+            }
 
-        if (hasScreenshot) {
-            if (hasChanged != NULL && currentScreenshot.height == capture.height && currentScreenshot.width == capture.width) {
-                // Compare the previous screenshot with the new one in order to determine if there was a change
-                cv::Mat lastScreen = cv::Mat(currentScreenshot.height, currentScreenshot.width, currentScreenshot.bits_per_pixels > 24 ? CV_8UC4 : CV_8UC3, currentScreenshot.pixels);
-                double errorL2 = norm(lastScreen, newScreen, cv::NORM_L2);
-                double similarity = errorL2 / (double) (lastScreen.rows * lastScreen.cols);
-                *hasChanged = similarity > 0.001;
-                if (hasMoved) {
-                    hasMoved = false;
-                    *hasChanged = true;
-                }
+            *hasChanged = !changes.empty();
+            if (dirtyRects != NULL) {
+                *dirtyRects = changes;
             }
+        }
+
+        // The replay backend gives the last screenshot recorded, so only the ones that changed are recorded
+        if (TraceRecorder::getInstance()->isRecording() && (hasChanged == NULL || *hasChanged)) {
+            TraceRecorder::getInstance()->recordScreenshot(wid, region.isEmpty() ? QRect(x, y, width, height) : region, newScreen);
+        }
 
+        if (hasScreenshot) {
             this->clearScreenshotMemory();
         }
 
@@ -108,9 +236,153 @@ cv::Mat ObservedWindow::getScreenshot(bool* hasChanged) {
         return newScreen;
     }
 
+    // Nothing was captured, so the damage still has to be analyzed
+    for (auto& rect : capturedDamage) {
+        addDamage(rect);
+    }
     return cv::Mat();
 }
 
+// Parts of the window redrawn since the last capture
+// Many small parts are merged into their bounding rect, since each of them is analyzed separately
+void ObservedWindow::addDamage(QRect rect) {
+    damageMutex.lock();
+    if (damage.size() >= MAX_DAMAGE_RECTS) {
+        QRect bounds = rect;
+        for (auto& damagedRect : damage) {
+            bounds |= damagedRect;
+        }
+        damage.clear();
+        rect = bounds;
+    }
+    damage.append(rect);
+    damageMutex.unlock();
+}
+
+// Take the damage accumulated since the last capture
+QList<QRect> ObservedWindow::takeDamage() {
+    damageMutex.lock();
+    QList<QRect> rects = damage;
+    damage.clear();
+    damageMutex.unlock();
+
+    return rects;
+}
+
+// Convert damaged *rects* (relative to the window) to rects of the *size* screenshot of the *capturedRect* screen rect
+std::vector<cv::Rect> ObservedWindow::damageToSceneRects(const QList<QRect>& rects, QRect capturedRect, cv::Size size) {
+    std::vector<cv::Rect> changes;
+    if (capturedRect.width() <= 0 || capturedRect.height() <= 0) {
+        return changes;
+    }
+
+    double scaleX = (double) size.width / capturedRect.width();
+    double scaleY = (double) size.height / capturedRect.height();
+    cv::Rect bounds(0, 0, size.width, size.height);
+    for (auto& rect : rects) {
+        cv::Rect change = cv::Rect((rect.x() + x - capturedRect.x()) * scaleX, (rect.y() + y - capturedRect.y()) * scaleY, qCeil(rect.width() * scaleX), qCeil(rect.height() * scaleY)) & bounds;
+        if (change.area() > 0) {
+            changes.push_back(change);
+        }
+    }
+
+    return changes;
+}
+
+// Requests are queued like the frames of the other stages, so requests made while a capture runs are merged into a single one
+// Returns true if no capture is running, in which case the caller has to start one
+bool ObservedWindow::requestCapture() {
+    return queueFrame(FigureFinderTask::Capture, AnalysisFrame());
+}
+
+void ObservedWindow::onCaptureStarted() {
+    damageMutex.lock();
+    lastCaptureTime = QDateTime::currentMSecsSinceEpoch();
+    damageMutex.unlock();
+}
+
+// The interval between two captures doubles each time the window's content did not change, and goes back to the minimum when a significant part of it did
+void ObservedWindow::onFrameCaptured(const std::vector<cv::Rect>& dirtyRects, cv::Size sceneSize) {
+    double dirtyArea = 0;
+    for (auto& dirtyRect : dirtyRects) {
+        dirtyArea += dirtyRect.area();
+    }
+
+    damageMutex.lock();
+    if (dirtyArea > MIN_ACTIVITY_AREA_RATIO * sceneSize.area()) {
+        captureInterval = Model::getInstance()->minTimeBetweenAnalyses.getValue();
+    } else {
+        captureInterval = qMin(captureInterval * 2, (qint64) Model::getInstance()->maxTimeBetweenAnalyses.getValue());
+    }
+    damageMutex.unlock();
+}
+
+// Whether the window should be captured now (for windows whose damage is not reported)
+// It is captured as soon as a scroll or a resize settles, at the highest rate while its content changes, and more and more rarely otherwise
+bool ObservedWindow::isCaptureDue() {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 msecsSinceInteraction = qMin(getMSecsSinceScroll(), now - lastGeometryChangeTime);
+
+    damageMutex.lock();
+    qint64 msecsSinceCapture = now - lastCaptureTime;
+    qint64 interval = qBound((qint64) Model::getInstance()->minTimeBetweenAnalyses.getValue(), captureInterval, (qint64) Model::getInstance()->maxTimeBetweenAnalyses.getValue());
+    damageMutex.unlock();
+
+    if (msecsSinceInteraction < INTERACTION_SETTLE_MSECS) {
+        // A long interaction should not hide the augmented views for too long either
+        return msecsSinceCapture >= Model::getInstance()->maxTimeBetweenAnalyses.getValue();
+    }
+    if (msecsSinceCapture > msecsSinceInteraction - INTERACTION_SETTLE_MSECS) {
+        // The window was not captured since the interaction settled
+        return true;
+    }
+    return msecsSinceCapture >= interval;
+}
+
+// Keypoints shifted by the scroll drift (the delta is rounded, descriptors near the new bands mix old and new pixels)
+// So the first capture after the interaction settled is fully analyzed, even if the window did not change since the last one
+bool ObservedWindow::isFullDetectionDue() {
+    if (getNbShiftedDetections() == 0) {
+        return false;
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 msecsSinceInteraction = qMin(getMSecsSinceScroll(), now - lastGeometryChangeTime);
+    damageMutex.lock();
+    qint64 msecsSinceCapture = now - lastCaptureTime;
+    damageMutex.unlock();
+
+    return msecsSinceInteraction >= INTERACTION_SETTLE_MSECS && msecsSinceCapture > msecsSinceInteraction - INTERACTION_SETTLE_MSECS;
+}
+
+// Compute a *cols*x*rows* mask of the window's screenshot covering *sceneRect* (the window or a part of it) where parts covered by other windows are set to 0
+// Returns an empty mask if this part of the window is fully visible
+cv::Mat ObservedWindow::getVisibilityMask(QRect sceneRect, int cols, int rows) {
+    cv::Mat mask;
+
+    if (sceneRect.width() <= 0 || sceneRect.height() <= 0) {
+        return mask;
+    }
+
+    // The screenshot can have a different resolution than the window (e.g. retina displays)
+    double scaleX = (double) cols / sceneRect.width();
+    double scaleY = (double) rows / sceneRect.height();
+    cv::Rect capturedRect(sceneRect.x(), sceneRect.y(), sceneRect.width(), sceneRect.height());
+
+    for (auto coveringRect : getWindowsAboveRects(wid)) {
+        cv::Rect hiddenRect = cv::Rect(coveringRect.x, coveringRect.y, coveringRect.width, coveringRect.height) & capturedRect;
+        if (hiddenRect.area() > 0) {
+            if (mask.empty()) {
+                mask = cv::Mat(rows, cols, CV_8U, cv::Scalar(255));
+            }
+            cv::Rect maskRect((hiddenRect.x - capturedRect.x) * scaleX, (hiddenRect.y - capturedRect.y) * scaleY, hiddenRect.width * scaleX, hiddenRect.height * scaleY);
+            mask(maskRect & cv::Rect(0, 0, cols, rows)).setTo(0);
+        }
+    }
+
+    return mask;
+}
+
 // Clear the screenshot memory used by calling getScreenshot
 void ObservedWindow::clearScreenshotMemory() {
     if (hasScreenshot) {
@@ -138,6 +410,8 @@ bool ObservedWindow::wasVisible() {
 }
 
 ObservedWindow::~ObservedWindow() {
+    clearScreenshotMemory();
+
     augmentedViewsMutex.lock();
     for (auto augmentedView : augmentedViews) {
         delete augmentedView;
@@ -22,7 +22,18 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include <opencv2/opencv.hpp>
 #include <QList>
 #include <QMutex>
+#include <QAtomicInt>
 #include "augmentedview.h"
+#include "figurefindertask.h"
+#include "algorithms/changedetector.h"
+
+// A scrollable part of a window (e.g. the document, or a sidebar)
+struct ScrollArea {
+    unsigned long id;
+    QRect rect;
+    double horizontalPos;
+    double verticalPos;
+};
 
 class ObservedWindow : public QObject
 {
@@ -34,10 +45,20 @@ public:
     void addFigure(Figure* figure);
     bool isVisible();
     bool wasVisible();
-    cv::Mat getScreenshot(bool* hasChanged = NULL);
+    cv::Mat getScreenshot(bool* hasChanged = NULL, std::vector<cv::Rect>* dirtyRects = NULL, bool grayscale = false, QRect region = QRect());
+    cv::Mat getVisibilityMask(QRect sceneRect, int cols, int rows);
     void clearScreenshotMemory();
     void hideAugmentedViews();
-    void onWindowScrolled(QRect scrollRect, double horizontalPos, double verticalPos);
+    void onWindowScrolled(unsigned long scrollAreaId, QRect scrollRect, double horizontalPos, double verticalPos);
+    bool queueFrame(FigureFinderTask::Stage stage, const AnalysisFrame& frame);
+    bool takeQueuedFrame(FigureFinderTask::Stage stage, AnalysisFrame* frame);
+    bool isAnalysisPending();
+    void addDamage(QRect rect);
+    bool requestCapture();
+    void onCaptureStarted();
+    void onFrameCaptured(const std::vector<cv::Rect>& dirtyRects, cv::Size sceneSize);
+    bool isCaptureDue();
+    bool isFullDetectionDue();
 
 
     inline processId getPid() {return pid;}
@@ -55,8 +76,21 @@ public:
     inline qint64 getMSecsSinceScroll() {return QDateTime::currentMSecsSinceEpoch() - lastScrollTime;}
     inline double getHScrollPos() {return lastHorizontalScrollPos;}
     inline double getVScrollPos() {return lastVerticalScrollPos;}
-    inline QRect getScrollRect() {return lastScrollRect;}
+    // The scroll area is only reported when it scrolls, so it is outdated (and the whole window is analyzed) once the window moved or got resized since
+    inline QRect getScrollRect() {return QRect(x, y, width, height) == lastScrollWindowRect ? lastScrollRect : QRect();}
+    // Only used by the detection stage, which never runs concurrently for the same window
+    inline AnalysisFrame& getDetectedFrame() {return detectedFrame;}
+    // Only used by the capture stage, which holds the analysis mutex
+    inline unsigned int nextCaptureId() {return ++lastCaptureId;}
+    inline void setDetectedFrame(const AnalysisFrame& frame) {detectedFrame = frame;}
+    // Set by the detection stage, see isFullDetectionDue
+    inline int getNbShiftedDetections() {return nbShiftedDetections.loadAcquire();}
+    inline void setNbShiftedDetections(int nb) {nbShiftedDetections.storeRelease(nb);}
+    inline bool isDamageReported() {return damageReported;}
+    inline void setDamageReported(bool reported) {damageReported = reported;}
+    inline qint64 getMSecsSinceCapture() {return QDateTime::currentMSecsSinceEpoch() - lastCaptureTime;}
 
+    inline void onGeometryChanged() {lastGeometryChangeTime = QDateTime::currentMSecsSinceEpoch();}
     inline void setX(int newX) {if (x != newX) hasMoved = true; x = newX;}
     inline void setY(int newY) {if (y != newY) hasMoved = true; y = newY;}
     inline void setWidth(int newWidth) {width = newWidth;}
@@ -66,15 +100,32 @@ public:
     inline void setTitle(const char* title) {if (title != NULL) strncpy(this->title, title, sizeof(this->title) - 1);}
 
 private:
+    int getScrollAreaOf(AugmentedView* augmentedView);
+    QList<QRect> takeDamage();
+    std::vector<cv::Rect> damageToSceneRects(const QList<QRect>& rects, QRect capturedRect, cv::Size size);
+
     screenshot currentScreenshot;
     bool hasScreenshot;
+    ChangeDetector changeDetector;
+    unsigned int lastCaptureId;
+    qint64 lastCaptureTime;
+    qint64 captureInterval; // See isCaptureDue
+    QAtomicInt nbShiftedDetections; // Detections since the last full one that reused keypoints shifted by the scroll
+    qint64 lastGeometryChangeTime;
+    // Parts of the window redrawn since the last capture (relative to the window), when reported by the system
+    bool damageReported;
+    QList<QRect> damage;
+    QMutex damageMutex;
     bool lastVisible;
     bool visible;
     bool frontMost;
     double hasScrollPos;
+    // Position and rect of the main scroll area (the document), see onWindowScrolled
     double lastVerticalScrollPos;
     double lastHorizontalScrollPos;
     QRect lastScrollRect;
+    QRect lastScrollWindowRect; // Geometry of the window when lastScrollRect was reported
+    QList<ScrollArea> scrollAreas;
     qint64 lastScrollTime;
 
     QList<AugmentedView*> augmentedViews;
@@ -91,6 +142,13 @@ private:
 
     QMutex augmentedViewsMutex;
     QMutex analysis;
+
+    // One slot per stage: a frame waiting for a busy stage is replaced by the newer one
+    QMutex pipelineMutex;
+    AnalysisFrame queuedFrames[FigureFinderTask::Matching + 1];
+    bool hasQueuedFrame[FigureFinderTask::Matching + 1];
+    bool stageRunning[FigureFinderTask::Matching + 1];
+    AnalysisFrame detectedFrame; // Last frame analyzed by the detection stage, without its pixels
 };
 
 #endif // OBSERVEDWINDOW_H
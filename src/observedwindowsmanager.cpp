@@ -20,6 +20,8 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include "os_specific/window.h"
 #include "figure.h"
 #include "figurefindertask.h"
+#include "database.h"
+#include "trace.h"
 #include <QThreadPool>
 #include <QDebug>
 #include <QEvent>
@@ -27,28 +29,72 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 
 #include "model/model.h"
 
-ObservedWindowsManager::ObservedWindowsManager() {
+// Windows whose damage is reported are still captured at this interval, in case a capture was skipped
+#define MAX_MSECS_WITHOUT_CAPTURE 2000
+
+// Look for the document shown by a window whose file path is unknown (see PageIndex)
+// Only the ids are kept, as the window may be destroyed before the task runs
+class DocumentIdentificationTask : public QRunnable
+{
+public:
+    DocumentIdentificationTask(Database* database, windowId wid, processId pid) : database(database), wid(wid), pid(pid) {}
+
+    void run() {
+        screenshot capture = captureScreenshot(wid, Model::getInstance()->grayscaleCapture.getValue());
+        if (!capture.width || !capture.height) {
+            return;
+        }
+
+        cv::Mat scene(capture.height, capture.width, capture.bits_per_pixels > 24 ? CV_8UC4 : (capture.bits_per_pixels > 8 ? CV_8UC3 : CV_8UC1), capture.pixels);
+        QString path = database->identifyDocument(scene);
+        clearCapturedScreenshotMemory(capture);
+
+        if (!path.isEmpty()) {
+            qDebug() << "Document identified visually:" << path;
+            // Same as if the OS told us that the process opened the file
+            onFileOpened(path.toStdString().c_str(), pid);
+        }
+    }
+
+private:
+    Database* database;
+    windowId wid;
+    processId pid;
+};
+
+ObservedWindowsManager::ObservedWindowsManager(Database* database) :
+    database(database) {
     this->connect(&refreshTimer, &QTimer::timeout, this, &ObservedWindowsManager::onRefreshTimer);
+    this->connect(&scheduleTimer, &QTimer::timeout, this, &ObservedWindowsManager::onScheduleTimer);
+    scheduleTimer.start(Model::getInstance()->minTimeBetweenAnalyses.getValue());
 
     Model::getInstance()->timeBetweenUpdates.addCallbackOnChange([=](int& val) {
         refreshTimer.start(val);
     });
 
+    Model::getInstance()->minTimeBetweenAnalyses.addCallbackOnChange([=](int& val) {
+        scheduleTimer.start(val);
+    });
+
     Model::getInstance()->useAccessibility.addCallbackOnChange([=](bool& val) {
         onAccessibilityStateChanged(val);
     });
 
+    Model::getInstance()->damageDrivenAnalysis.addCallbackOnChange([=](bool& val) {
+        onDamageDrivenAnalysisChanged(val);
+    });
+
     qRegisterMetaType<processId>("processId");
     qRegisterMetaType<QList<Figure*>>("QList<Figure*>");
     connect(this, SIGNAL(newFiguresDetected(processId,QList<Figure*>)), this, SLOT(onNewFiguresDetected(processId,QList<Figure*>)), Qt::QueuedConnection);
 }
 
 void ObservedWindowsManager::onRefreshTimer() {
+    // The replay backend rebuilds the windows' order from the updates following this event
+    TraceRecorder::getInstance()->record(TraceEvent(WindowsListed));
     updateOpenedWindows();
 
     observedWindowsMutex.lock();
-    QThreadPool* threadPool = QThreadPool::globalInstance();
-    bool observedWindowVisible = false;
     for (auto observedWindow : observedWindows) {
         if (observedWindow->getAugmentedViews().size() > 0) {
             bool shouldBeAnalyzed = (observedWindow->isVisible() || strlen(observedWindow->getTitle()) > 0);
@@ -57,11 +103,8 @@ void ObservedWindowsManager::onRefreshTimer() {
                 shouldBeAnalyzed = observedWindow->isFrontMost();
             }
 
-            if (shouldBeAnalyzed) {
-                observedWindowVisible = true;
-                FigureFinderTask* finderTask = new FigureFinderTask(observedWindow);
-                threadPool->start(finderTask);
-            } else {
+            // The windows to analyze are captured by the scheduler (see onScheduleTimer)
+            if (!shouldBeAnalyzed) {
                 for (auto views : observedWindow->getAugmentedViews()) {
                     emit views->figureNotFound();
                 }
@@ -71,6 +114,23 @@ void ObservedWindowsManager::onRefreshTimer() {
     observedWindowsMutex.unlock();
 }
 
+// Runs every minTimeBetweenAnalyses, each window deciding whether it needs a new capture
+void ObservedWindowsManager::onScheduleTimer() {
+    observedWindowsMutex.lock();
+    for (auto observedWindow : observedWindows) {
+        if (!shouldBeAnalyzed(observedWindow)) {
+            continue;
+        }
+
+        // Windows whose damage is reported are captured when they are redrawn (see onWindowDamaged), or once a scroll settled to be fully analyzed
+        bool due = observedWindow->isDamageReported() ? observedWindow->getMSecsSinceCapture() >= MAX_MSECS_WITHOUT_CAPTURE || observedWindow->isFullDetectionDue() : observedWindow->isCaptureDue();
+        if (due) {
+            requestCapture(observedWindow);
+        }
+    }
+    observedWindowsMutex.unlock();
+}
+
 void ObservedWindowsManager::onAccessibilityStateChanged(bool newState) {
     if (newState) {
         observedWindowsMutex.lock();
@@ -85,12 +145,54 @@ void ObservedWindowsManager::onAccessibilityStateChanged(bool newState) {
     }
 }
 
+void ObservedWindowsManager::onDamageDrivenAnalysisChanged(bool newState) {
+    observedWindowsMutex.lock();
+    for (auto observedWindow : observedWindows) {
+        if (observedWindow->getAugmentedViews().size() > 0) {
+            if (newState) {
+                observedWindow->setDamageReported(registerDamageCallback(observedWindow->getWid()));
+            } else if (observedWindow->isDamageReported()) {
+                freeRegisteredDamageCallback(observedWindow->getWid());
+                observedWindow->setDamageReported(false);
+            }
+        }
+    }
+    observedWindowsMutex.unlock();
+}
+
+// Start a capture of a window, unless one is already running (which then captures the window again once done)
+void ObservedWindowsManager::requestCapture(ObservedWindow* wnd) {
+    if (wnd->requestCapture()) {
+        QThreadPool::globalInstance()->start(new FigureFinderTask(wnd));
+    }
+}
+
+// Same test as the refresh timer, except that the window's visibility is not updated (only the refresh timer does it)
+// Also called from the X11 events thread (onWindowDamaged), while figures are added on the main thread
+bool ObservedWindowsManager::shouldBeAnalyzed(ObservedWindow* wnd) {
+    wnd->getAugmentedViewsMutex().lock();
+    bool hasFigures = !wnd->getAugmentedViews().isEmpty();
+    wnd->getAugmentedViewsMutex().unlock();
+    if (!hasFigures) {
+        return false;
+    }
+
+    if (Model::getInstance()->onlyAnalyzeActiveWindow.getValue()) {
+        return wnd->isFrontMost();
+    }
+    return wnd->isOnScreen() || strlen(wnd->getTitle()) > 0;
+}
+
 void ObservedWindowsManager::addFigureToWindow(ObservedWindow* wnd, Figure* figure) {
     wnd->addFigure(figure);
 
     if (Model::getInstance()->useAccessibility.getValue()) {
         registerScrollCallback(wnd->getPid(), wnd->getWid());
     }
+
+    if (Model::getInstance()->damageDrivenAnalysis.getValue() && !wnd->isDamageReported()) {
+        wnd->setDamageReported(registerDamageCallback(wnd->getWid()));
+    }
 }
 
 void ObservedWindowsManager::onWindowUpdated(windowId wid, processId pid, int x, int y, int width, int height, bool isOnScreen, const char* title, bool isFrontMost) {
@@ -100,6 +202,11 @@ void ObservedWindowsManager::onWindowUpdated(windowId wid, processId pid, int x,
     while (i.hasNext()) {
         ObservedWindow* wnd = i.next();
         if (wnd->getAnalysisMutex().tryLock()) {
+            // Captures are only requested for windows still in the list, so once none runs or waits, no new frame can be queued from here
+            if (wnd->isAnalysisPending()) {
+                wnd->getAnalysisMutex().unlock();
+                continue;
+            }
             i.remove();
             delete wnd;
         }
@@ -128,6 +235,15 @@ void ObservedWindowsManager::onWindowUpdated(windowId wid, processId pid, int x,
         observedWindowsMutex.unlock();
     }
 
+    // A window without figures just got the focus, maybe because we do not know its file
+    bool focused = isFrontMost && !wnd->isFrontMost();
+    if (focused && wnd->getAugmentedViews().isEmpty() && Model::getInstance()->identifyDocumentsVisually.getValue()) {
+        QThreadPool::globalInstance()->start(new DocumentIdentificationTask(database, wid, pid));
+    }
+
+    // Moving a window or bringing it to the front does not always redraw it
+    bool moved = wnd->getX() != x || wnd->getY() != y || wnd->getWidth() != width || wnd->getHeight() != height;
+
     wnd->setX(x);
     wnd->setY(y);
     wnd->setWidth(width);
@@ -135,14 +251,22 @@ void ObservedWindowsManager::onWindowUpdated(windowId wid, processId pid, int x,
     wnd->setOnScreen(isOnScreen);
     wnd->setTitle(title);
     wnd->setFrontMost(isFrontMost);
+
+    if (moved) {
+        wnd->onGeometryChanged();
+    }
+
+    if (wnd->isDamageReported() && (moved || focused) && shouldBeAnalyzed(wnd)) {
+        requestCapture(wnd);
+    }
 }
 
-void ObservedWindowsManager::onWindowScrolled(windowId wid, int x, int y, int width, int height, double horizontalPos, double verticalPos) {
+void ObservedWindowsManager::onWindowScrolled(windowId wid, unsigned long scrollAreaId, int x, int y, int width, int height, double horizontalPos, double verticalPos) {
     observedWindowsMutex.lock();
 
     for (auto observedWindow : observedWindows) {
         if (observedWindow->getWid() == wid) {
-            observedWindow->onWindowScrolled(QRect(x, y, width, height), horizontalPos, verticalPos);
+            observedWindow->onWindowScrolled(scrollAreaId, QRect(x, y, width, height), horizontalPos, verticalPos);
         }
      }
 
@@ -156,6 +280,9 @@ void ObservedWindowsManager::onWindowDestroyed(windowId wid) {
         ObservedWindow* wnd = i.next();
         if (wnd->getWid() == wid) {
             i.remove();
+            if (wnd->isDamageReported()) {
+                freeRegisteredDamageCallback(wid);
+            }
             wnd->hideAugmentedViews();
             observedWindowsTrashCan.append(wnd);
         }
@@ -163,6 +290,20 @@ void ObservedWindowsManager::onWindowDestroyed(windowId wid) {
     observedWindowsMutex.unlock();
 }
 
+// Called by the system (from any thread) when a part of a window is redrawn
+void ObservedWindowsManager::onWindowDamaged(windowId wid, int x, int y, int width, int height) {
+    observedWindowsMutex.lock();
+    for (auto observedWindow : observedWindows) {
+        if (observedWindow->getWid() == wid && observedWindow->isDamageReported()) {
+            observedWindow->addDamage(QRect(x, y, width, height));
+            if (shouldBeAnalyzed(observedWindow)) {
+                requestCapture(observedWindow);
+            }
+        }
+    }
+    observedWindowsMutex.unlock();
+}
+
 // Add a new figure to look for
 // We should only look for the figure in the windows of the specified process id
 void ObservedWindowsManager::addFigure(processId pid, Figure* figure) {
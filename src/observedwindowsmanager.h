@@ -26,17 +26,19 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 
 class Figure;
 class ObservedWindow;
+class Database;
 
 class ObservedWindowsManager : public QObject
 {
     Q_OBJECT
 
 public:
-    ObservedWindowsManager();
+    ObservedWindowsManager(Database* database);
     void onWindowOpened(windowId wid, processId pid);
     void onWindowUpdated(windowId wid, processId pid, int x, int y, int width, int height, bool isOnScreen, const char* title, bool isFrontMost);
-    void onWindowScrolled(windowId wid, int x, int y, int width, int height, double horizontalPos, double verticalPos);
+    void onWindowScrolled(windowId wid, unsigned long scrollAreaId, int x, int y, int width, int height, double horizontalPos, double verticalPos);
     void onWindowDestroyed(windowId wid);
+    void onWindowDamaged(windowId wid, int x, int y, int width, int height);
     void addFigure(processId pid, Figure* figure);
     inline QList<ObservedWindow*> getWindows() {return observedWindows;}
     void dispatchMouseMovedEvent(int x, int y);
@@ -46,14 +48,20 @@ signals:
 
 private slots:
     void onRefreshTimer();
+    void onScheduleTimer();
     void onNewFiguresDetected(processId pid, QList<Figure*> figures);
     void onFigureDeleted(int id);
 
 private:
     void addFigureToWindow(ObservedWindow* wnd, Figure* figure);
     void onAccessibilityStateChanged(bool newState);
+    void onDamageDrivenAnalysisChanged(bool newState);
+    void requestCapture(ObservedWindow* wnd);
+    bool shouldBeAnalyzed(ObservedWindow* wnd);
 
+    Database* database;
     QTimer refreshTimer;
+    QTimer scheduleTimer;
     QList<ObservedWindow*> observedWindows;
     QList<ObservedWindow*> observedWindowsTrashCan;
     QMutex observedWindowsMutex;
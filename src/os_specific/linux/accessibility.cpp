@@ -0,0 +1,60 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include <string>
+#include <algorithm>
+#include "accessibility.h"
+#include "atspilistener.h"
+#include "files.h"
+
+// Documents shown by the active window, given by its toolkit when possible, or found in the files opened by its process
+std::vector<std::string> getActiveWindowFiles() {
+    windowId wid = getActiveWindow();
+    std::vector<std::string> windowFiles = AtspiListener::getInstance()->getDocuments(wid);
+
+    for (auto& file : procfsGetOpenedFiles(getWindowPid(wid))) {
+        if (std::find(windowFiles.begin(), windowFiles.end(), file) == windowFiles.end()) {
+            windowFiles.push_back(file);
+        }
+    }
+
+    return windowFiles;
+}
+
+// There is nothing to grant. Without the accessibility bus, scrolling is still detected visually
+bool requestAccessibilityPermission() {
+    AtspiListener::getInstance()->connectToBus();
+    return true;
+}
+
+// Scroll bars are only found when they change, so no lookup is needed here
+bool registerScrollCallback(processId pid, windowId wid) {
+    AtspiListener::getInstance()->observeWindow(pid, wid);
+    return true;
+}
+
+void freeRegisteredScrollCallbacks() {
+    AtspiListener::getInstance()->forgetWindows();
+}
+
+// Documents are found along with the scroll areas (see AtspiListener::lookForDocument), and in /proc (see files.cpp)
+void accessibilityLookForOpenedFiles(QSet<processId>) {
+}
+
+void accessibilityDestroyWindow(windowId wid) {
+    AtspiListener::getInstance()->forgetWindow(wid);
+}
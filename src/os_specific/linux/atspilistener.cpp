@@ -0,0 +1,451 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include "atspilistener.h"
+#include "accessibility.h"
+#include <QDBusConnectionInterface>
+#include <QDBusArgument>
+#include <QDBusObjectPath>
+#include <QDBusVariant>
+#include <QDBusMetaType>
+#include <QDBusPendingCallWatcher>
+#include <QDateTime>
+#include <QStringList>
+#include <QUrl>
+#include <QDebug>
+
+// ms, calls to the applications are asynchronous so that a busy application does not freeze the main thread
+#define ATSPI_TIMEOUT 1000
+// ms, the extents of a scroll area are only asked again after this delay (e.g. in case the window was resized)
+#define ATSPI_EXTENTS_REFRESH 500
+
+// From atspi-constants.h
+#define ATSPI_ROLE_SCROLL_BAR 48
+#define ATSPI_ROLE_SCROLL_PANE 49
+#define ATSPI_STATE_VERTICAL 29
+#define ATSPI_COORD_TYPE_SCREEN 0
+
+#define ATSPI_ACCESSIBLE "org.a11y.atspi.Accessible"
+
+AtspiListener* AtspiListener::getInstance() {
+    static AtspiListener instance;
+    return &instance;
+}
+
+AtspiListener::AtspiListener() :
+    bus(QDBusConnection::sessionBus()), connected(false) {
+}
+
+// The accessibility bus is a separate bus, whose address is given by the session bus
+bool AtspiListener::connectToBus() {
+    if (connected) {
+        return true;
+    }
+
+    QDBusConnection sessionBus = QDBusConnection::sessionBus();
+    QDBusMessage reply = sessionBus.call(QDBusMessage::createMethodCall("org.a11y.Bus", "/org/a11y/bus", "org.a11y.Bus", "GetAddress"), QDBus::Block, ATSPI_TIMEOUT);
+    if (reply.type() != QDBusMessage::ReplyMessage || reply.arguments().isEmpty()) {
+        qWarning() << "AT-SPI unavailable, scrolling will only be detected visually";
+        return false;
+    }
+
+    // Toolkits only expose their widgets once an assistive technology asked for them
+    QDBusMessage enable = QDBusMessage::createMethodCall("org.a11y.Bus", "/org/a11y/bus", "org.freedesktop.DBus.Properties", "Set");
+    enable << QString("org.a11y.Status") << QString("IsEnabled") << QVariant::fromValue(QDBusVariant(true));
+    sessionBus.call(enable, QDBus::NoBlock);
+
+    bus = QDBusConnection::connectToBus(reply.arguments().at(0).toString(), "chameleon-atspi");
+    if (!bus.isConnected()) {
+        return false;
+    }
+
+    bus.connect(QString(), QString(), "org.a11y.atspi.Event.Object", "PropertyChange", this, SLOT(onPropertyChange(QDBusMessage)));
+    // Applications only send the events someone registered for
+    QDBusMessage registerEvent = QDBusMessage::createMethodCall("org.a11y.atspi.Registry", "/org/a11y/atspi/registry", "org.a11y.atspi.Registry", "RegisterEvent");
+    registerEvent << QString("object:property-change:accessible-value");
+    bus.call(registerEvent, QDBus::NoBlock);
+
+    connected = true;
+    return true;
+}
+
+void AtspiListener::observeWindow(processId pid, windowId wid) {
+    connectToBus();
+
+    observedWindowsMutex.lock();
+    if (!observedWindows.contains(pid, wid)) {
+        observedWindows.insert(pid, wid);
+    }
+    observedWindowsMutex.unlock();
+}
+
+void AtspiListener::forgetWindow(windowId wid) {
+    observedWindowsMutex.lock();
+    for (auto pid : observedWindows.keys(wid)) {
+        observedWindows.remove(pid, wid);
+    }
+    observedWindowsMutex.unlock();
+
+    // The scroll bars of these areas, and the applications without observed windows, are found again if needed
+    QSet<QString> forgottenAreas;
+    QMutableHashIterator<QString, AtspiScrollArea> i(scrollAreas);
+    while (i.hasNext()) {
+        if (i.next().value().wid == wid) {
+            forgottenAreas.insert(i.key());
+            i.remove();
+        }
+    }
+
+    QSet<QString> forgottenServices;
+    observedWindowsMutex.lock();
+    QMutableHashIterator<QString, processId> j(processes);
+    while (j.hasNext()) {
+        j.next();
+        if (j.value() != 0 && !observedWindows.contains(j.value())) {
+            forgottenServices.insert(j.key());
+            j.remove();
+        }
+    }
+    observedWindowsMutex.unlock();
+
+    QMutableHashIterator<QString, AtspiScrollBar> k(scrollBars);
+    while (k.hasNext()) {
+        k.next();
+        if (forgottenServices.contains(k.value().service) || forgottenAreas.contains(k.value().service + k.value().areaPath)) {
+            k.remove();
+        }
+    }
+    documents.remove(wid);
+}
+
+void AtspiListener::forgetWindows() {
+    observedWindowsMutex.lock();
+    observedWindows.clear();
+    observedWindowsMutex.unlock();
+
+    processes.clear();
+    scrollBars.clear();
+    scrollAreas.clear();
+    pendingAreas.clear();
+    documents.clear();
+}
+
+std::vector<std::string> AtspiListener::getDocuments(windowId wid) {
+    return documents.value(wid);
+}
+
+// The reply (or the error) is given to *callback* on the main thread
+void AtspiListener::callAsync(const QString& service, const QString& path, const QString& interface, const QString& method, const QList<QVariant>& arguments, std::function<void (const QDBusMessage&)> callback) {
+    QDBusMessage message = QDBusMessage::createMethodCall(service, path, interface, method);
+    message.setArguments(arguments);
+    QDBusPendingCallWatcher* watcher = new QDBusPendingCallWatcher(bus.asyncCall(message, ATSPI_TIMEOUT), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [watcher, callback]() {
+        watcher->deleteLater();
+        callback(watcher->reply());
+    });
+}
+
+void AtspiListener::getPropertyAsync(const QString& service, const QString& path, const QString& interface, const QString& name, std::function<void (const QVariant&)> callback) {
+    callAsync(service, path, "org.freedesktop.DBus.Properties", "Get", {interface, name}, [callback](const QDBusMessage& reply) {
+        if (reply.type() != QDBusMessage::ReplyMessage || reply.arguments().isEmpty()) {
+            callback(QVariant());
+        } else {
+            callback(reply.arguments().at(0).value<QDBusVariant>().variant());
+        }
+    });
+}
+
+// Returns an empty path for an invalid reference, or the root of the application
+static QString getReferencePath(const QVariant& reference) {
+    if (!reference.canConvert<QDBusArgument>()) {
+        return QString();
+    }
+
+    const QDBusArgument argument = reference.value<QDBusArgument>();
+    QString service;
+    QDBusObjectPath path;
+    argument.beginStructure();
+    argument >> service >> path;
+    argument.endStructure();
+
+    return path.path() == "/org/a11y/atspi/null" ? QString() : path.path();
+}
+
+static QRect getExtentsOf(const QDBusMessage& reply) {
+    if (reply.type() != QDBusMessage::ReplyMessage || reply.arguments().isEmpty()) {
+        return QRect();
+    }
+
+    const QDBusArgument argument = reply.arguments().at(0).value<QDBusArgument>();
+    int x, y, width, height;
+    argument.beginStructure();
+    argument >> x >> y >> width >> height;
+    argument.endStructure();
+
+    return QRect(x, y, width, height);
+}
+
+// AT-SPI does not know the X11 windows, so the scroll area is matched with the windows of its process by position
+windowId AtspiListener::getWindowOf(processId pid, QRect rect) {
+    observedWindowsMutex.lock();
+    QList<windowId> wids = observedWindows.values(pid);
+    observedWindowsMutex.unlock();
+
+    if (wids.size() == 1) {
+        return wids.first();
+    }
+
+    for (auto wid : wids) {
+        windowRect bounds;
+        if (getWindowRect(wid, &bounds) && QRect(bounds.x, bounds.y, bounds.width, bounds.height).contains(rect.center())) {
+            return wid;
+        }
+    }
+    return 0;
+}
+
+// Web browsers and some viewers expose the URL of the document shown in the scroll area (e.g. a PDF opened in Firefox)
+void AtspiListener::lookForDocument(const QString& service, const QString& areaPath, processId pid, windowId wid) {
+    callAsync(service, areaPath, ATSPI_ACCESSIBLE, "GetChildren", {}, [=](const QDBusMessage& reply) {
+        if (reply.type() != QDBusMessage::ReplyMessage || reply.arguments().isEmpty()) {
+            return;
+        }
+
+        QStringList childrenPaths;
+        const QDBusArgument children = reply.arguments().at(0).value<QDBusArgument>();
+        children.beginArray();
+        while (!children.atEnd()) {
+            QString childService;
+            QDBusObjectPath childPath;
+            children.beginStructure();
+            children >> childService >> childPath;
+            children.endStructure();
+            childrenPaths.append(childPath.path());
+        }
+        children.endArray();
+
+        for (auto& childPath : childrenPaths) {
+            callAsync(service, childPath, ATSPI_ACCESSIBLE, "GetInterfaces", {}, [=](const QDBusMessage& reply) {
+                if (!reply.arguments().value(0).toStringList().contains("org.a11y.atspi.Document")) {
+                    return;
+                }
+
+                callAsync(service, childPath, "org.a11y.atspi.Document", "GetAttributeValue", {QString("DocURL")}, [=](const QDBusMessage& reply) {
+                    QUrl url(reply.arguments().value(0).toString());
+                    observedWindowsMutex.lock();
+                    bool observed = observedWindows.contains(pid, wid);
+                    observedWindowsMutex.unlock();
+                    if (observed && url.isLocalFile()) {
+                        std::string path = url.toLocalFile().toStdString();
+                        documents[wid].push_back(path);
+                        onFileOpened(path.c_str(), pid);
+                    }
+                });
+            });
+        }
+    });
+}
+
+// The role, orientation and scroll pane of a scroll bar are asked once, its events being ignored meanwhile
+// A failed call forgets the scroll bar, so that the next event asks again
+void AtspiListener::resolveScrollBar(const QString& service, const QString& path) {
+    QString barKey = service + path;
+    callAsync(service, path, ATSPI_ACCESSIBLE, "GetRole", {}, [=](const QDBusMessage& reply) {
+        if (!scrollBars.contains(barKey)) {
+            return;
+        }
+        if (reply.type() != QDBusMessage::ReplyMessage) {
+            scrollBars.remove(barKey);
+            return;
+        }
+        // Other widgets with a value (e.g. sliders) are remembered too, without scroll area
+        if (reply.arguments().value(0).toUInt() != ATSPI_ROLE_SCROLL_BAR) {
+            scrollBars[barKey].resolved = true;
+            return;
+        }
+
+        callAsync(service, path, ATSPI_ACCESSIBLE, "GetState", {}, [=](const QDBusMessage& reply) {
+            if (!scrollBars.contains(barKey)) {
+                return;
+            }
+            if (reply.type() != QDBusMessage::ReplyMessage) {
+                scrollBars.remove(barKey);
+                return;
+            }
+            QList<uint> states = qdbus_cast<QList<uint>>(reply.arguments().value(0));
+            scrollBars[barKey].horizontal = states.isEmpty() || !(states.first() & (1 << ATSPI_STATE_VERTICAL));
+            findScrollPane(service, path, barKey, 0);
+        });
+    });
+}
+
+// Qt puts the scroll bars in a container next to the viewport, so the scroll pane can be a few levels above the scroll bar
+void AtspiListener::findScrollPane(const QString& service, const QString& path, const QString& barKey, int depth) {
+    getPropertyAsync(service, path, ATSPI_ACCESSIBLE, "Parent", [=](const QVariant& parent) {
+        if (!scrollBars.contains(barKey)) {
+            return;
+        }
+        QString parentPath = getReferencePath(parent);
+        if (parentPath.isEmpty()) {
+            scrollBars[barKey].resolved = true;
+            return;
+        }
+
+        callAsync(service, parentPath, ATSPI_ACCESSIBLE, "GetRole", {}, [=](const QDBusMessage& reply) {
+            if (!scrollBars.contains(barKey)) {
+                return;
+            }
+            if (reply.arguments().value(0).toUInt() == ATSPI_ROLE_SCROLL_PANE) {
+                scrollBars[barKey].areaPath = parentPath;
+                scrollBars[barKey].resolved = true;
+            } else if (depth < 3) {
+                findScrollPane(service, parentPath, barKey, depth + 1);
+            } else {
+                scrollBars[barKey].resolved = true;
+            }
+        });
+    });
+}
+
+void AtspiListener::onPropertyChange(const QDBusMessage& message) {
+    QList<QVariant> arguments = message.arguments();
+    if (arguments.isEmpty() || arguments.at(0).toString() != "accessible-value") {
+        return;
+    }
+
+    QString service = message.service();
+    QString path = message.path();
+
+    // Only the applications owning observed windows are followed, their process being asked on their first event
+    if (!processes.contains(service)) {
+        processes[service] = 0;
+        callAsync("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetConnectionUnixProcessID", {service}, [=](const QDBusMessage& reply) {
+            if (reply.type() != QDBusMessage::ReplyMessage) {
+                processes.remove(service);
+            } else if (processes.contains(service)) {
+                processes[service] = reply.arguments().value(0).toUInt();
+            }
+        });
+        return;
+    }
+    processId pid = processes.value(service);
+    observedWindowsMutex.lock();
+    bool observed = pid != 0 && observedWindows.contains(pid);
+    observedWindowsMutex.unlock();
+    if (!observed) {
+        return;
+    }
+
+    QString barKey = service + path;
+    if (!scrollBars.contains(barKey)) {
+        AtspiScrollBar scrollBar;
+        scrollBar.service = service;
+        scrollBar.horizontal = false;
+        scrollBar.resolved = false;
+        scrollBars[barKey] = scrollBar;
+        resolveScrollBar(service, path);
+        return;
+    }
+
+    AtspiScrollBar scrollBar = scrollBars.value(barKey);
+    if (!scrollBar.resolved || scrollBar.areaPath.isEmpty()) {
+        return;
+    }
+
+    // The new value comes with the event (any_data), it is only asked to the application when it does not
+    // Scroll bars of scrolled widgets count in pixels with GTK and Qt. Their minimum does not matter since positions are relative to the first value
+    bool hasValue = false;
+    double value = arguments.size() > 3 ? arguments.at(3).value<QDBusVariant>().variant().toDouble(&hasValue) : 0;
+    if (hasValue) {
+        onScrollBarMoved(service, barKey, pid, value);
+    } else {
+        getPropertyAsync(service, path, "org.a11y.atspi.Value", "CurrentValue", [=](const QVariant& currentValue) {
+            if (currentValue.isValid() && scrollBars.contains(barKey)) {
+                onScrollBarMoved(service, barKey, pid, currentValue.toDouble());
+            }
+        });
+    }
+}
+
+void AtspiListener::onScrollBarMoved(const QString& service, const QString& barKey, processId pid, double position) {
+    AtspiScrollBar scrollBar = scrollBars.value(barKey);
+    QString areaKey = service + scrollBar.areaPath;
+
+    // The window of the scroll area is found from its position, asked once
+    if (!scrollAreas.contains(areaKey)) {
+        if (pendingAreas.contains(areaKey)) {
+            return;
+        }
+        pendingAreas.insert(areaKey);
+        callAsync(service, scrollBar.areaPath, "org.a11y.atspi.Component", "GetExtents", {QVariant::fromValue((uint) ATSPI_COORD_TYPE_SCREEN)}, [=](const QDBusMessage& reply) {
+            if (!pendingAreas.remove(areaKey) || reply.type() != QDBusMessage::ReplyMessage) {
+                return;
+            }
+
+            AtspiScrollArea area;
+            area.rect = getExtentsOf(reply);
+            area.lastExtentsUpdate = QDateTime::currentMSecsSinceEpoch();
+            area.wid = getWindowOf(pid, area.rect);
+            area.horizontalPos = 0;
+            area.verticalPos = 0;
+            area.hasHorizontalOrigin = false;
+            area.hasVerticalOrigin = false;
+            if (area.wid == 0) {
+                return;
+            }
+            scrollAreas[areaKey] = area;
+            lookForDocument(service, scrollBar.areaPath, pid, area.wid);
+        });
+        return;
+    }
+
+    // The value of a scroll bar is only known once it changed, so this first value becomes its origin
+    AtspiScrollArea& area = scrollAreas[areaKey];
+    if (scrollBar.horizontal) {
+        if (!area.hasHorizontalOrigin) {
+            area.horizontalOrigin = position;
+            area.hasHorizontalOrigin = true;
+        }
+        area.horizontalPos = position - area.horizontalOrigin;
+    } else {
+        if (!area.hasVerticalOrigin) {
+            area.verticalOrigin = position;
+            area.hasVerticalOrigin = true;
+        }
+        area.verticalPos = position - area.verticalOrigin;
+    }
+
+    // The cached extents are reported right away, and reported again if they changed meanwhile
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - area.lastExtentsUpdate >= ATSPI_EXTENTS_REFRESH) {
+        area.lastExtentsUpdate = now;
+        callAsync(service, scrollBar.areaPath, "org.a11y.atspi.Component", "GetExtents", {QVariant::fromValue((uint) ATSPI_COORD_TYPE_SCREEN)}, [=](const QDBusMessage& reply) {
+            QRect rect = getExtentsOf(reply);
+            if (scrollAreas.contains(areaKey) && !rect.isEmpty() && rect != scrollAreas[areaKey].rect) {
+                scrollAreas[areaKey].rect = rect;
+                reportScroll(areaKey);
+            }
+        });
+    }
+
+    reportScroll(areaKey);
+}
+
+void AtspiListener::reportScroll(const QString& areaKey) {
+    AtspiScrollArea area = scrollAreas.value(areaKey);
+    onWindowScrolled(area.wid, qHash(areaKey), area.rect.x(), area.rect.y(), area.rect.width(), area.rect.height(), area.horizontalPos, area.verticalPos);
+}
@@ -0,0 +1,94 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#ifndef LINUX_ATSPILISTENER_H
+#define LINUX_ATSPILISTENER_H
+
+#include <QObject>
+#include <QHash>
+#include <QMultiHash>
+#include <QSet>
+#include <QMutex>
+#include <QRect>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <string>
+#include <vector>
+#include <functional>
+#include "../window.h"
+
+// A scroll bar of an application, known from its first value change
+struct AtspiScrollBar {
+    QString service;
+    QString areaPath; // The scroll pane containing the scroll bar
+    bool horizontal;
+    bool resolved; // Whether its role and scroll pane are known (see AtspiListener::resolveScrollBar)
+};
+
+// Positions are relative to the first value of each scroll bar, as only their changes matter
+struct AtspiScrollArea {
+    windowId wid;
+    QRect rect;
+    qint64 lastExtentsUpdate;
+    double horizontalPos;
+    double verticalPos;
+    double horizontalOrigin;
+    double verticalOrigin;
+    bool hasHorizontalOrigin;
+    bool hasVerticalOrigin;
+};
+
+// Follows the scroll bars of the observed windows through AT-SPI2, the accessibility bus of the session (the equivalent of AXObserver on macOS)
+// Everything runs on the main thread, where the D-Bus signals and replies are delivered
+class AtspiListener : public QObject
+{
+    Q_OBJECT
+
+public:
+    static AtspiListener* getInstance();
+    bool connectToBus();
+    void observeWindow(processId pid, windowId wid);
+    void forgetWindow(windowId wid);
+    void forgetWindows();
+    std::vector<std::string> getDocuments(windowId wid);
+
+private slots:
+    void onPropertyChange(const QDBusMessage& message);
+
+private:
+    AtspiListener();
+    void callAsync(const QString& service, const QString& path, const QString& interface, const QString& method, const QList<QVariant>& arguments, std::function<void (const QDBusMessage&)> callback);
+    void getPropertyAsync(const QString& service, const QString& path, const QString& interface, const QString& name, std::function<void (const QVariant&)> callback);
+    windowId getWindowOf(processId pid, QRect rect);
+    void lookForDocument(const QString& service, const QString& areaPath, processId pid, windowId wid);
+    void resolveScrollBar(const QString& service, const QString& path);
+    void findScrollPane(const QString& service, const QString& path, const QString& barKey, int depth);
+    void onScrollBarMoved(const QString& service, const QString& barKey, processId pid, double position);
+    void reportScroll(const QString& areaKey);
+
+    QDBusConnection bus;
+    bool connected;
+    QMutex observedWindowsMutex;
+    QMultiHash<processId, windowId> observedWindows;
+    QHash<QString, processId> processes; // By bus name (0 while it is being asked)
+    QHash<QString, AtspiScrollBar> scrollBars; // By bus name and path
+    QHash<QString, AtspiScrollArea> scrollAreas; // By bus name and path
+    QSet<QString> pendingAreas; // Whose extents are being asked
+    QHash<windowId, std::vector<std::string>> documents;
+};
+
+#endif // LINUX_ATSPILISTENER_H
@@ -0,0 +1,317 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include <QSet>
+#include <QHash>
+#include <QMutex>
+#include <QDebug>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <mntent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include "files.h"
+
+// Seconds between two scans of the visible processes' files, when fanotify is not permitted
+#define PROCFS_SCAN_INTERVAL 2
+
+// Only these files can be documents with registered figures
+static const char* documentExtensions[] = {".pdf", ".ps", ".djvu", ".epub", ".xps", ".odp", ".odt", ".ppt", ".pptx", ".doc", ".docx", ".html", ".htm", NULL};
+// Pseudo and read-only image file systems, which do not hold documents
+static const char* ignoredFileSystems[] = {"proc", "sysfs", "devtmpfs", "devpts", "cgroup", "cgroup2", "securityfs", "pstore", "debugfs", "tracefs", "configfs",
+                                           "mqueue", "hugetlbfs", "autofs", "bpf", "fusectl", "binfmt_misc", "efivarfs", "squashfs", NULL};
+static const char* ignoredDirectories[] = {"/proc/", "/sys/", "/dev/", "/run/", NULL};
+
+static pthread_t hookThread;
+static bool hookInstalled = false;
+static int fanotifyFd = -1;
+// Written to stop the hook's thread
+static int stopPipe[2];
+
+static QMutex procfsMutex;
+static QSet<processId> visibleProcesses;
+// Documents already reported per process, so that a document kept open is not reported at each scan
+static QHash<processId, QSet<QString>> reportedFiles;
+
+// Called for every opened file, so the test is done on the raw path, before any allocation
+static bool isCandidateDocument(const char* path) {
+    // Sockets and pipes are named e.g. "socket:[1234]"
+    if (path[0] != '/') {
+        return false;
+    }
+
+    for (int i = 0; ignoredDirectories[i] != NULL; ++i) {
+        if (strncmp(path, ignoredDirectories[i], strlen(ignoredDirectories[i])) == 0) {
+            return false;
+        }
+    }
+
+    const char* extension = strrchr(path, '.');
+    if (extension == NULL || strchr(extension, '/') != NULL) {
+        return false;
+    }
+
+    for (int i = 0; documentExtensions[i] != NULL; ++i) {
+        if (strcasecmp(extension, documentExtensions[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isIgnoredFileSystem(const char* type) {
+    for (int i = 0; ignoredFileSystems[i] != NULL; ++i) {
+        if (strcmp(type, ignoredFileSystems[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Documents currently opened by *pid*, processes of other users cannot be read without privileges
+static QSet<QString> getOpenedDocuments(processId pid) {
+    QSet<QString> openedFiles;
+    char fdDirPath[64];
+    snprintf(fdDirPath, sizeof(fdDirPath), "/proc/%lu/fd", pid);
+    DIR* fdDir = opendir(fdDirPath);
+    if (fdDir == NULL) {
+        return openedFiles;
+    }
+
+    char linkPath[PATH_MAX];
+    char path[PATH_MAX];
+    struct dirent* entry;
+    while ((entry = readdir(fdDir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(linkPath, sizeof(linkPath), "%s/%s", fdDirPath, entry->d_name);
+        ssize_t length = readlink(linkPath, path, sizeof(path) - 1);
+        if (length > 0) {
+            path[length] = 0;
+            if (isCandidateDocument(path)) {
+                openedFiles.insert(QString::fromLocal8Bit(path));
+            }
+        }
+    }
+    closedir(fdDir);
+
+    return openedFiles;
+}
+
+// Report the documents opened by *pid*, only the ones not reported by the previous scan if *onlyNew*
+static void scanProcess(processId pid, bool onlyNew) {
+    QSet<QString> openedFiles = getOpenedDocuments(pid);
+
+    procfsMutex.lock();
+    QSet<QString> newFiles = onlyNew ? openedFiles - reportedFiles.value(pid) : openedFiles;
+    // Closed documents are forgotten, so that they are reported again if reopened
+    reportedFiles[pid] = openedFiles;
+    procfsMutex.unlock();
+
+    for (auto& file : newFiles) {
+        onFileOpened(file.toLocal8Bit().constData(), pid);
+    }
+}
+
+// Returns true if stopPipe was written before *timeout* ms
+static bool waitForStop(int timeout) {
+    struct pollfd stopFd = {stopPipe[0], POLLIN, 0};
+    return poll(&stopFd, 1, timeout) > 0;
+}
+
+// Unprivileged fallback: documents are only found in the processes owning visible windows, and only while they keep them open
+static void* procfsThread(void*) {
+    while (!waitForStop(PROCFS_SCAN_INTERVAL * 1000)) {
+        procfsMutex.lock();
+        QSet<processId> pids = visibleProcesses;
+        procfsMutex.unlock();
+
+        for (auto pid : pids) {
+            scanProcess(pid, true);
+        }
+    }
+    return NULL;
+}
+
+static void* fanotifyThread(void*) {
+    char buffer[8192] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    char linkPath[64];
+    char path[PATH_MAX];
+    struct pollfd fds[2] = {{fanotifyFd, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+
+    while (true) {
+        int ready = poll(fds, 2, -1);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready < 0 || (fds[1].revents & POLLIN)) {
+            break;
+        }
+
+        ssize_t length = read(fanotifyFd, buffer, sizeof(buffer));
+        struct fanotify_event_metadata* event = (struct fanotify_event_metadata*) buffer;
+        while (length > 0 && FAN_EVENT_OK(event, length)) {
+            // Each event comes with a descriptor of the opened file, which gives its path
+            if (event->fd >= 0) {
+                if (event->pid != getpid()) {
+                    snprintf(linkPath, sizeof(linkPath), "/proc/self/fd/%d", event->fd);
+                    ssize_t pathLength = readlink(linkPath, path, sizeof(path) - 1);
+                    if (pathLength > 0) {
+                        path[pathLength] = 0;
+                        if (isCandidateDocument(path)) {
+                            onFileOpened(path, event->pid);
+                        }
+                    }
+                }
+                close(event->fd);
+            }
+            event = FAN_EVENT_NEXT(event, length);
+        }
+    }
+
+    close(fanotifyFd);
+    fanotifyFd = -1;
+    return NULL;
+}
+
+// fanotify reports the files of whole mounts, so only the mounts that can hold documents are marked
+static bool markMounts() {
+    FILE* mounts = setmntent("/proc/self/mounts", "r");
+    if (mounts == NULL) {
+        return false;
+    }
+
+    int nbMarked = 0;
+    struct mntent* mount;
+    while ((mount = getmntent(mounts)) != NULL) {
+        if (!isIgnoredFileSystem(mount->mnt_type) && fanotify_mark(fanotifyFd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN, AT_FDCWD, mount->mnt_dir) == 0) {
+            nbMarked++;
+        }
+    }
+    endmntent(mounts);
+
+    return nbMarked > 0;
+}
+
+// Report the documents opened by any process through fanotify, which requires CAP_SYS_ADMIN
+// Otherwise, the processes owning visible windows are scanned periodically
+bool installFileOpenHook() {
+    if (hookInstalled || pipe(stopPipe) != 0) {
+        return hookInstalled;
+    }
+
+    fanotifyFd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC, O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (fanotifyFd >= 0 && markMounts()) {
+        pthread_create(&hookThread, NULL, fanotifyThread, NULL);
+    } else {
+        if (fanotifyFd >= 0) {
+            close(fanotifyFd);
+            fanotifyFd = -1;
+        }
+        qDebug() << "fanotify not permitted, the files opened by the visible windows' processes will be scanned instead";
+        pthread_create(&hookThread, NULL, procfsThread, NULL);
+    }
+
+    hookInstalled = true;
+    return true;
+}
+
+void uninstallFileOpenHook() {
+    if (!hookInstalled) {
+        return;
+    }
+
+    if (write(stopPipe[1], "", 1) == 1) {
+        pthread_join(hookThread, NULL);
+    }
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+    hookInstalled = false;
+}
+
+typedef struct _processesScan {
+    QSet<processId> pids;
+    bool onlyNew;
+} processesScan;
+
+// scanPtr is deallocated at the end
+static void* lookForOpenedFilesThread(void* scanPtr) {
+    processesScan* scan = (processesScan*) scanPtr;
+    for (auto pid : scan->pids) {
+        scanProcess(pid, scan->onlyNew);
+    }
+
+    delete scan;
+    return NULL;
+}
+
+static void startLookingForOpenedFilesThread(QSet<processId> pids, bool onlyNew) {
+    processesScan* scan = new processesScan;
+    scan->pids = pids;
+    scan->onlyNew = onlyNew;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, lookForOpenedFilesThread, (void*) scan) == 0) {
+        pthread_detach(thread);
+    } else {
+        delete scan;
+    }
+}
+
+std::vector<std::string> procfsGetOpenedFiles(processId pid) {
+    std::vector<std::string> files;
+    for (auto& file : getOpenedDocuments(pid)) {
+        files.push_back(file.toLocal8Bit().constData());
+    }
+    return files;
+}
+
+// Called with the processes of the new windows, whether the hook is installed or not
+void procfsLookForOpenedFiles(QSet<processId> pids) {
+    startLookingForOpenedFilesThread(pids, true);
+}
+
+// Processes owning the windows on screen, scanned when fanotify is not permitted
+void procfsSetVisibleProcesses(QSet<processId> pids) {
+    procfsMutex.lock();
+    visibleProcesses = pids;
+    // The documents of the other processes are reported again if they come back on screen
+    for (auto pid : reportedFiles.keys()) {
+        if (!pids.contains(pid)) {
+            reportedFiles.remove(pid);
+        }
+    }
+    procfsMutex.unlock();
+}
+
+// All the documents of the visible processes are reported, even the ones already reported (e.g. one with a new figure)
+void lookForOpenedFiles() {
+    procfsMutex.lock();
+    QSet<processId> pids = visibleProcesses;
+    procfsMutex.unlock();
+
+    startLookingForOpenedFilesThread(pids, false);
+}
@@ -0,0 +1,555 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include <opencv2/opencv.hpp>
+#include <string>
+#include "../window.h"
+#include "../screenshotpool.h"
+#include "accessibility.h"
+#include "files.h"
+#include <QDebug>
+#include <QCoreApplication>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QMutex>
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+// X11 comes last, its macros (None, Bool, Status...) clash with Qt's headers
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/XInput2.h>
+#include <X11/extensions/Xdamage.h>
+
+// Shared images kept aside for the next captures of the same size
+#define MAX_FREE_SHM_IMAGES 8
+
+// Used by the main thread to list the windows (Xlib calls are thread-safe thanks to XInitThreads)
+static Display* display = NULL;
+// Captures are done by the analysis threads, with their own connection so that they do not wait for the window list
+static Display* captureDisplay = NULL;
+// Receives the mouse moves and the damage of the observed windows, see eventsThread
+static Display* eventsDisplay = NULL;
+static bool hasShm = false;
+static bool hasDamage = false;
+static int damageEventBase = 0;
+static int xiOpcode = 0;
+
+static Atom netClientListStacking;
+static Atom netActiveWindow;
+static Atom netWmPid;
+static Atom netWmName;
+static Atom netWmState;
+static Atom netWmStateHidden;
+static Atom utf8String;
+
+// Client windows from bottom to top, as of the last call to updateOpenedWindows, used for the occlusion queries
+static QMutex windowsMutex;
+static QList<windowId> stackingOrder;
+static QHash<windowId, windowRect> visibleWindowsRects;
+
+typedef struct _shmImage {
+    XImage* image;
+    XShmSegmentInfo info;
+    int depth;
+} shmImage;
+
+static QMutex shmImagesMutex;
+static QList<shmImage*> freeShmImages;
+
+static QMutex damagesMutex;
+static QHash<windowId, Damage> damages;
+
+// Windows can be destroyed at any time, in which case requests about them fail. The callers check the results instead
+static int ignoreErrors(Display*, XErrorEvent*) {
+    return 0;
+}
+
+// Returns the items of *property* of *window*, to free with XFree (NULL if the property is not set)
+static unsigned char* getProperty(Display* dpy, Window window, Atom property, Atom type, unsigned long* nbItems) {
+    Atom actualType;
+    int actualFormat;
+    unsigned long bytesAfter;
+    unsigned char* data = NULL;
+
+    *nbItems = 0;
+    if (XGetWindowProperty(dpy, window, property, 0, ~0L, False, type, &actualType, &actualFormat, nbItems, &bytesAfter, &data) != Success || data == NULL) {
+        *nbItems = 0;
+        return NULL;
+    }
+
+    return data;
+}
+
+static std::string getWindowTitle(Window window) {
+    std::string title;
+    unsigned long length;
+    unsigned char* name = getProperty(display, window, netWmName, utf8String, &length);
+
+    if (name != NULL) {
+        title = std::string((char*) name, length);
+        XFree(name);
+    } else {
+        char* legacyName = NULL;
+        if (XFetchName(display, window, &legacyName) && legacyName != NULL) {
+            title = legacyName;
+            XFree(legacyName);
+        }
+    }
+
+    return title;
+}
+
+static bool isWindowMinimized(Window window) {
+    unsigned long nbStates;
+    Atom* states = (Atom*) getProperty(display, window, netWmState, XA_ATOM, &nbStates);
+    bool minimized = false;
+
+    for (unsigned long i = 0; i < nbStates; ++i) {
+        minimized |= states[i] == netWmStateHidden;
+    }
+
+    if (states != NULL) {
+        XFree(states);
+    }
+    return minimized;
+}
+
+static shmImage* acquireShmImage(Visual* visual, int depth, int width, int height) {
+    shmImagesMutex.lock();
+    for (int i = 0; i < freeShmImages.size(); ++i) {
+        shmImage* shm = freeShmImages.at(i);
+        if (shm->image->width == width && shm->image->height == height && shm->depth == depth) {
+            freeShmImages.removeAt(i);
+            shmImagesMutex.unlock();
+            return shm;
+        }
+    }
+    shmImagesMutex.unlock();
+
+    shmImage* shm = new shmImage;
+    shm->depth = depth;
+    shm->image = XShmCreateImage(captureDisplay, visual, depth, ZPixmap, NULL, &shm->info, width, height);
+    if (shm->image == NULL) {
+        delete shm;
+        return NULL;
+    }
+
+    shm->info.shmid = shmget(IPC_PRIVATE, shm->image->bytes_per_line * height, IPC_CREAT | 0600);
+    shm->info.shmaddr = shm->image->data = (char*) shmat(shm->info.shmid, 0, 0);
+    shm->info.readOnly = False;
+    bool attached = shm->info.shmaddr != (char*) -1 && XShmAttach(captureDisplay, &shm->info);
+    XSync(captureDisplay, False);
+    // The segment is destroyed once both the X server and us detached from it
+    shmctl(shm->info.shmid, IPC_RMID, 0);
+
+    if (!attached) {
+        shm->image->data = NULL;
+        XDestroyImage(shm->image);
+        delete shm;
+        return NULL;
+    }
+
+    return shm;
+}
+
+static void destroyShmImage(shmImage* shm) {
+    XShmDetach(captureDisplay, &shm->info);
+    shm->image->data = NULL;
+    XDestroyImage(shm->image);
+    shmdt(shm->info.shmaddr);
+    delete shm;
+}
+
+static void releaseShmImage(shmImage* shm) {
+    shmImagesMutex.lock();
+    freeShmImages.prepend(shm);
+    shmImage* oldest = freeShmImages.size() > MAX_FREE_SHM_IMAGES ? freeShmImages.takeLast() : NULL;
+    shmImagesMutex.unlock();
+
+    if (oldest != NULL) {
+        destroyShmImage(oldest);
+    }
+}
+
+// Mouse moves are received through XInput2 raw events, which are sent whatever the window under the cursor
+// Damage events of the observed windows (see registerDamageCallback) are received here too
+static void* eventsThread(void*) {
+    Window root = DefaultRootWindow(eventsDisplay);
+    if (xiOpcode) {
+        unsigned char maskBits[XIMaskLen(XI_LASTEVENT)] = {0};
+        XIEventMask mask;
+        mask.deviceid = XIAllMasterDevices;
+        mask.mask_len = sizeof(maskBits);
+        mask.mask = maskBits;
+        XISetMask(maskBits, XI_RawMotion);
+        XISelectEvents(eventsDisplay, root, &mask, 1);
+        XFlush(eventsDisplay);
+    }
+
+    while (true) {
+        XEvent event;
+        XNextEvent(eventsDisplay, &event);
+
+        if (hasDamage && event.type == damageEventBase + XDamageNotify) {
+            // Raw rectangles are reported one by one, relative to the window
+            XDamageNotifyEvent* damage = (XDamageNotifyEvent*) &event;
+            onWindowDamaged(damage->drawable, damage->area.x, damage->area.y, damage->area.width, damage->area.height);
+        } else if (xiOpcode && event.xcookie.type == GenericEvent && event.xcookie.extension == xiOpcode && XGetEventData(eventsDisplay, &event.xcookie)) {
+            if (event.xcookie.evtype == XI_RawMotion) {
+                // Raw events are relative, so the absolute position is queried
+                Window rootReturn, childReturn;
+                int x, y, winX, winY;
+                unsigned int buttons;
+                if (XQueryPointer(eventsDisplay, root, &rootReturn, &childReturn, &x, &y, &winX, &winY, &buttons)) {
+                    // The augmented views are only handled from the main thread
+                    QMetaObject::invokeMethod(qApp, [x, y]() {onMouseMoved(x, y);}, Qt::QueuedConnection);
+                }
+            }
+            XFreeEventData(eventsDisplay, &event.xcookie);
+        }
+    }
+
+    return NULL;
+}
+
+void initialize() {
+    // Already done when checking the screen capture permission
+    if (display != NULL) {
+        return;
+    }
+
+    XInitThreads();
+    XSetErrorHandler(ignoreErrors);
+    display = XOpenDisplay(NULL);
+    captureDisplay = XOpenDisplay(NULL);
+    eventsDisplay = XOpenDisplay(NULL);
+    // display stays NULL, so that requestScreenCapturePermission fails
+    if (display == NULL || captureDisplay == NULL || eventsDisplay == NULL) {
+        qWarning() << "Could not open the X11 display";
+        for (Display* dpy : {display, captureDisplay, eventsDisplay}) {
+            if (dpy != NULL) {
+                XCloseDisplay(dpy);
+            }
+        }
+        display = captureDisplay = eventsDisplay = NULL;
+        return;
+    }
+
+    netClientListStacking = XInternAtom(display, "_NET_CLIENT_LIST_STACKING", False);
+    netActiveWindow = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
+    netWmPid = XInternAtom(display, "_NET_WM_PID", False);
+    netWmName = XInternAtom(display, "_NET_WM_NAME", False);
+    netWmState = XInternAtom(display, "_NET_WM_STATE", False);
+    netWmStateHidden = XInternAtom(display, "_NET_WM_STATE_HIDDEN", False);
+    utf8String = XInternAtom(display, "UTF8_STRING", False);
+
+    // Shared memory is only possible when the X server runs on this machine
+    hasShm = XShmQueryExtension(captureDisplay);
+    if (!hasShm) {
+        qWarning() << "MIT-SHM unavailable, screenshots will be slower";
+    }
+
+    // XI2 requests are only handled once the client announced the version it speaks
+    int firstEvent, firstError;
+    int xiMajor = 2, xiMinor = 0;
+    if (!XQueryExtension(eventsDisplay, "XInputExtension", &xiOpcode, &firstEvent, &firstError) || XIQueryVersion(eventsDisplay, &xiMajor, &xiMinor) != Success) {
+        xiOpcode = 0;
+        qWarning() << "XInput2 unavailable, mouse moves will not be tracked";
+    }
+
+    int damageErrorBase;
+    hasDamage = XDamageQueryExtension(eventsDisplay, &damageEventBase, &damageErrorBase);
+    if (!hasDamage) {
+        qWarning() << "XDamage unavailable, windows will be captured periodically";
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, eventsThread, NULL);
+}
+
+// There is nothing to grant on X11, we only check that the display can be captured
+bool requestScreenCapturePermission() {
+    if (display == NULL) {
+        initialize();
+    }
+    return display != NULL;
+}
+
+windowId getActiveWindow() {
+    unsigned long nbItems;
+    unsigned long* active = (unsigned long*) getProperty(display, DefaultRootWindow(display), netActiveWindow, XA_WINDOW, &nbItems);
+    windowId wid = 0;
+
+    if (active != NULL) {
+        wid = nbItems > 0 ? active[0] : 0;
+        XFree(active);
+    }
+    return wid;
+}
+
+QSet<windowId> openedWindows;
+void updateOpenedWindows() {
+    if (display == NULL) {
+        return;
+    }
+
+    Window root = DefaultRootWindow(display);
+    unsigned long nbWindows;
+    // Managed windows from bottom to top (EWMH), only maintained by window managers
+    unsigned long* windows = (unsigned long*) getProperty(display, root, netClientListStacking, XA_WINDOW, &nbWindows);
+    windowId activeWindow = getActiveWindow();
+
+    QList<windowId> newStackingOrder;
+    QHash<windowId, windowRect> newVisibleRects;
+    QSet<processId> processesWithNewWindows;
+    QSet<processId> visibleProcesses;
+    QSet<windowId> closedWindows(openedWindows);
+    openedWindows.clear();
+
+    // From top to bottom, as on macOS
+    for (long i = (long) nbWindows - 1; i >= 0; --i) {
+        Window window = windows[i];
+        XWindowAttributes attributes;
+        if (!XGetWindowAttributes(display, window, &attributes)) {
+            continue;
+        }
+
+        int x, y;
+        Window child;
+        XTranslateCoordinates(display, window, root, 0, 0, &x, &y, &child);
+
+        processId pid = getWindowPid(window);
+
+        bool isOnScreen = attributes.map_state == IsViewable && !isWindowMinimized(window);
+        std::string title = getWindowTitle(window);
+
+        onWindowUpdated(window, pid, x, y, attributes.width, attributes.height, isOnScreen, title.c_str(), window == activeWindow);
+
+        newStackingOrder.prepend(window);
+        if (isOnScreen) {
+            windowRect rect;
+            rect.x = x;
+            rect.y = y;
+            rect.width = attributes.width;
+            rect.height = attributes.height;
+            newVisibleRects[window] = rect;
+            visibleProcesses.insert(pid);
+        }
+
+        openedWindows.insert(window);
+        if (!closedWindows.contains(window)) {
+            processesWithNewWindows.insert(pid);
+        }
+        closedWindows.remove(window);
+    }
+
+    if (windows != NULL) {
+        XFree(windows);
+    }
+
+    windowsMutex.lock();
+    stackingOrder = newStackingOrder;
+    visibleWindowsRects = newVisibleRects;
+    windowsMutex.unlock();
+
+    procfsSetVisibleProcesses(visibleProcesses);
+    if (!processesWithNewWindows.isEmpty()) {
+        accessibilityLookForOpenedFiles(processesWithNewWindows);
+        procfsLookForOpenedFiles(processesWithNewWindows);
+    }
+
+    for (auto window : closedWindows) {
+        onWindowDestroyed(window);
+        accessibilityDestroyWindow(window);
+    }
+}
+
+// Return the bounds of the on screen windows above *wid* (i.e. the windows that can cover it)
+std::vector<windowRect> getWindowsAboveRects(windowId wid) {
+    std::vector<windowRect> rects;
+
+    windowsMutex.lock();
+    int index = stackingOrder.indexOf(wid);
+    if (index >= 0) {
+        for (int i = index + 1; i < stackingOrder.size(); ++i) {
+            if (visibleWindowsRects.contains(stackingOrder.at(i))) {
+                rects.push_back(visibleWindowsRects[stackingOrder.at(i)]);
+            }
+        }
+    }
+    windowsMutex.unlock();
+
+    return rects;
+}
+
+// Bounds of *wid* if it is on screen, as of the last call to updateOpenedWindows
+bool getWindowRect(windowId wid, windowRect* rect) {
+    windowsMutex.lock();
+    bool visible = visibleWindowsRects.contains(wid);
+    if (visible) {
+        *rect = visibleWindowsRects[wid];
+    }
+    windowsMutex.unlock();
+
+    return visible;
+}
+
+processId getWindowPid(windowId wid) {
+    unsigned long nbItems;
+    unsigned long* pidProperty = (unsigned long*) getProperty(display, wid, netWmPid, XA_CARDINAL, &nbItems);
+    processId pid = 0;
+    if (pidProperty != NULL) {
+        pid = nbItems > 0 ? pidProperty[0] : 0;
+        XFree(pidProperty);
+    }
+    return pid;
+}
+
+bool isWindowPartHidden(windowId wid, int x, int y, int width, int height) {
+    cv::Rect rect(x, y, width, height);
+    for (auto wndRect : getWindowsAboveRects(wid)) {
+        if ((rect & cv::Rect(wndRect.x, wndRect.y, wndRect.width, wndRect.height)).area() > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isWindowRectHidden(windowId wid, int x, int y, int width, int height) {
+    return isWindowPartHidden(wid, x, y, width, height);
+}
+
+// The pixels are read from the X server through a shared memory segment (no copy through the socket)
+// and converted in one pass into a buffer of the pool, in RGBA or grayscale
+screenshot captureScreenshot(windowId windowId, bool grayscale, int x, int y, int width, int height) {
+    screenshot screenData;
+    screenData.pixels = NULL;
+    screenData._data = NULL;
+    screenData.width = 0;
+    screenData.height = 0;
+    screenData.bits_per_pixels = 0;
+
+    XWindowAttributes attributes;
+    if (captureDisplay == NULL || !XGetWindowAttributes(captureDisplay, windowId, &attributes) || attributes.map_state != IsViewable) {
+        return screenData;
+    }
+
+    int originX, originY;
+    Window child;
+    XTranslateCoordinates(captureDisplay, windowId, DefaultRootWindow(captureDisplay), 0, 0, &originX, &originY, &child);
+
+    cv::Rect area(0, 0, attributes.width, attributes.height);
+    if (width > 0 && height > 0) {
+        area &= cv::Rect(x - originX, y - originY, width, height);
+    }
+    // Reading pixels outside of the screen fails (BadMatch), so the part of a window dragged off-screen is left black
+    cv::Rect visibleArea = area & cv::Rect(-originX, -originY, WidthOfScreen(attributes.screen), HeightOfScreen(attributes.screen));
+    if (visibleArea.empty()) {
+        return screenData;
+    }
+
+    shmImage* shm = NULL;
+    XImage* image = NULL;
+    if (hasShm) {
+        shm = acquireShmImage(attributes.visual, attributes.depth, visibleArea.width, visibleArea.height);
+        if (shm != NULL && XShmGetImage(captureDisplay, windowId, shm->image, visibleArea.x, visibleArea.y, AllPlanes)) {
+            image = shm->image;
+        }
+    }
+    // Without shared memory (e.g. when the limit of segments is reached), the pixels go through the socket
+    if (shm == NULL) {
+        image = XGetImage(captureDisplay, windowId, visibleArea.x, visibleArea.y, visibleArea.width, visibleArea.height, AllPlanes, ZPixmap);
+    }
+
+    // Only TrueColor 24/32 bits visuals (BGRX in memory) are supported
+    if (image != NULL && image->bits_per_pixel == 32) {
+        cv::Mat source(visibleArea.height, visibleArea.width, CV_8UC4, image->data, image->bytes_per_line);
+        cv::Mat* screenshotMat = new cv::Mat(ScreenshotPool::getInstance()->acquire(area.height, area.width, grayscale ? CV_8UC1 : CV_8UC4));
+        cv::Mat target = (*screenshotMat)(visibleArea - area.tl());
+
+        if (grayscale) {
+            if (visibleArea != area) {
+                screenshotMat->setTo(cv::Scalar(0));
+            }
+            // Same weights as FeatureMatchingAlgorithm::toGrayscale on the RGBA image, the source being BGRA
+            cv::cvtColor(source, target, cv::COLOR_RGBA2GRAY);
+        } else {
+            // The alpha channel is undefined for 24 bits windows
+            screenshotMat->setTo(cv::Scalar(0, 0, 0, 255));
+            int fromTo[] = {2, 0, 1, 1, 0, 2};
+            cv::mixChannels(&source, 1, &target, 1, fromTo, 3);
+        }
+
+        screenData.pixels = screenshotMat->data;
+        screenData._data = (void*) screenshotMat;
+        screenData.width = area.width;
+        screenData.height = area.height;
+        screenData.bits_per_pixels = grayscale ? 8 : 32;
+    }
+
+    if (shm != NULL) {
+        releaseShmImage(shm);
+    } else if (image != NULL) {
+        XDestroyImage(image);
+    }
+
+    return screenData;
+}
+
+void clearCapturedScreenshotMemory(screenshot scrnsht) {
+    cv::Mat* screenshotMat = (cv::Mat*) scrnsht._data;
+    if (screenshotMat != NULL) {
+        ScreenshotPool::getInstance()->release(*screenshotMat);
+        delete screenshotMat;
+    }
+}
+
+// Chameleon has no icon in the taskbar on X11, so there is nothing to change
+void setActivationEnabled(bool) {
+}
+
+// Report the parts of *wid* drawn by its application through onWindowDamaged, so that it is only captured when it changes
+// Returns false if the X server cannot report them
+bool registerDamageCallback(windowId wid) {
+    if (!hasDamage) {
+        return false;
+    }
+
+    damagesMutex.lock();
+    if (!damages.contains(wid)) {
+        // Created on the events' connection, which is the one receiving the notifications
+        damages[wid] = XDamageCreate(eventsDisplay, wid, XDamageReportRawRectangles);
+        XFlush(eventsDisplay);
+    }
+    damagesMutex.unlock();
+
+    return true;
+}
+
+void freeRegisteredDamageCallback(windowId wid) {
+    damagesMutex.lock();
+    if (damages.contains(wid)) {
+        // Fails harmlessly if the window was destroyed, the server then already freed the damage
+        XDamageDestroy(eventsDisplay, damages.take(wid));
+        XFlush(eventsDisplay);
+    }
+    damagesMutex.unlock();
+}
@@ -30,10 +30,13 @@ extern "C" AXError _AXUIElementGetWindow(AXUIElementRef, CGWindowID* out);
 
 typedef struct _scrollArea {
     AXUIElementRef element;
+    processId pid;
     double horizontalPos;
     double verticalPos;
     int x;
     int y;
+    int width;
+    int height;
 } scrollArea;
 
 QHash<windowId, QList<scrollArea*>> windowScrollAreas;
@@ -242,14 +245,16 @@ static void notificationCallback(AXObserverRef observer, AXUIElementRef element,
         getElementBounds(sArea->element, &size, &point);
 
         if (horizontalPos != sArea->horizontalPos || verticalPos != sArea->verticalPos ||
-                sArea->x != point.x || sArea->y != point.y) {
+                sArea->x != point.x || sArea->y != point.y || sArea->width != size.width || sArea->height != size.height) {
             sArea->horizontalPos = horizontalPos;
             sArea->verticalPos = verticalPos;
             sArea->x = point.x;
             sArea->y = point.y;
+            sArea->width = size.width;
+            sArea->height = size.height;
             CGWindowID wid;
             _AXUIElementGetWindow(element, &wid);
-            onWindowScrolled(wid, point.x, point.y, size.width, size.height, horizontalPos, verticalPos);
+            onWindowScrolled(wid, (unsigned long) sArea, point.x, point.y, size.width, size.height, horizontalPos, verticalPos);
         }
     }
 }
@@ -279,8 +284,36 @@ void installNotificationsScrollArea(processId pid, scrollArea* sArea) {
         CFRelease(horizontalScrollbar);
     }
 
+    // The scroll area moves and gets resized with its window, which does not change the scroll bars' values
     if (window != NULL) {
         AXObserverAddNotification(*observers[pid], window, kAXWindowMovedNotification, sArea);
+        AXObserverAddNotification(*observers[pid], window, kAXWindowResizedNotification, sArea);
+        CFRelease(window);
+    }
+}
+
+void removeNotificationsScrollArea(scrollArea* sArea) {
+    if (observers.find(sArea->pid) == observers.end()) {
+        return;
+    }
+
+    AXUIElementRef verticalScrollbar = (AXUIElementRef) getAttributeValue(sArea->element, kAXVerticalScrollBarAttribute);
+    AXUIElementRef horizontalScrollbar = (AXUIElementRef) getAttributeValue(sArea->element, kAXHorizontalScrollBarAttribute);
+    AXUIElementRef window = (AXUIElementRef) getAttributeValue(sArea->element, kAXWindowAttribute);
+
+    if (verticalScrollbar != NULL) {
+        AXObserverRemoveNotification(*observers[sArea->pid], verticalScrollbar, kAXValueChangedNotification);
+        CFRelease(verticalScrollbar);
+    }
+
+    if (horizontalScrollbar != NULL) {
+        AXObserverRemoveNotification(*observers[sArea->pid], horizontalScrollbar, kAXValueChangedNotification);
+        CFRelease(horizontalScrollbar);
+    }
+
+    if (window != NULL) {
+        AXObserverRemoveNotification(*observers[sArea->pid], window, kAXWindowMovedNotification);
+        AXObserverRemoveNotification(*observers[sArea->pid], window, kAXWindowResizedNotification);
         CFRelease(window);
     }
 }
@@ -304,7 +337,15 @@ bool registerScrollCallback(processId pid, AXUIElementRef windowElement) {
         for (auto element : scrollAreasElement) {
             scrollArea* sArea = new scrollArea;
             sArea->element = element;
+            sArea->pid = pid;
             getScrollbarPositions(element, &sArea->horizontalPos, &sArea->verticalPos);
+            CGSize size;
+            CGPoint point;
+            getElementBounds(element, &size, &point);
+            sArea->x = point.x;
+            sArea->y = point.y;
+            sArea->width = size.width;
+            sArea->height = size.height;
             scrollAreas.append(sArea);
             dispatch_async(dispatch_get_main_queue(), ^{
                 installNotificationsScrollArea(pid, sArea);
@@ -442,12 +483,17 @@ void accessibilityUpdateWindow(processId, windowId wid) {
     windowScrollAreasMutex.unlock();
 }
 
+// The notifications are installed and delivered on the main run loop, so the scroll areas are released there, once no callback can use them anymore
 void freeScrollAreas(windowId wid) {
     if (windowScrollAreas.contains(wid)) {
-        for (auto sArea : windowScrollAreas[wid]) {
-            CFRelease(sArea->element);
-            delete sArea;
-        }
+        QList<scrollArea*> scrollAreas = windowScrollAreas[wid];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            for (auto sArea : scrollAreas) {
+                removeNotificationsScrollArea(sArea);
+                CFRelease(sArea->element);
+                delete sArea;
+            }
+        });
     }
 }
 
@@ -22,6 +22,8 @@ along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
 #include <pthread.h>
 #include <QSet>
 #include "accessibility.h"
+#include "../screenshotpool.h"
+#include "algorithms/featurematchingalgorithm.h"
 #include <AppKit/AppKit.h>
 #import <Cocoa/Cocoa.h>
 #import <Carbon/Carbon.h>
@@ -243,36 +245,48 @@ bool isWindowRectHidden(windowId wid,int x, int y, int width, int height) {
 }
 
 
-screenshot captureScreenshot(windowId windowId) {
+screenshot captureScreenshot(windowId windowId, bool grayscale, int x, int y, int width, int height) {
     screenshot screenData;
-    CGImageRef imageRef = CGWindowListCreateImage(CGRectNull, kCGWindowListOptionIncludingWindow, windowId, kCGWindowImageBoundsIgnoreFraming | kCGWindowImageNominalResolution);
+    CGRect bounds = width > 0 && height > 0 ? CGRectMake(x, y, width, height) : CGRectNull;
+    CGImageRef imageRef = CGWindowListCreateImage(bounds, kCGWindowListOptionIncludingWindow, windowId, kCGWindowImageBoundsIgnoreFraming | kCGWindowImageNominalResolution);
 
     screenData.width = CGImageGetWidth(imageRef);
     screenData.height = CGImageGetHeight(imageRef);
-    screenData.bits_per_pixels = CGImageGetBitsPerPixel(imageRef);
+    screenData.bits_per_pixels = grayscale ? 8 : CGImageGetBitsPerPixel(imageRef);
 
-    CGColorSpaceRef colorSpace = CGImageGetColorSpace(imageRef);
     CGFloat cols = CGImageGetWidth(imageRef);
     CGFloat rows = CGImageGetHeight(imageRef);
 
     // (TODO : remove the use of opencv)
-    cv::Mat* screenshotMat = new cv::Mat(rows, cols, CV_8UC4);
+    // The window is usually captured with the same size as the last time, so its buffer comes from the pool
+    cv::Mat* screenshotMat = new cv::Mat(ScreenshotPool::getInstance()->acquire(rows, cols, CV_8UC4));
 
     CGContextRef contextRef = CGBitmapContextCreate(screenshotMat->data, cols, rows, 8, screenshotMat->step[0],
-            colorSpace, kCGImageAlphaNoneSkipLast | kCGBitmapByteOrderDefault);
-
-    screenData.pixels = (unsigned char*) screenshotMat->data;
-    screenData._data = (void*) screenshotMat;
-
+            CGImageGetColorSpace(imageRef), kCGImageAlphaNoneSkipLast | kCGBitmapByteOrderDefault);
     CGContextDrawImage(contextRef, CGRectMake(0, 0, cols, rows), imageRef);
     CGContextRelease(contextRef);
     CGImageRelease(imageRef);
 
+    // Core Graphics' gray color space does not weight the channels like the detector does with the figures, so the conversion is done here
+    // The color buffer goes back to the pool right away, only the grayscale screenshot moves through the analysis
+    if (grayscale) {
+        cv::Mat* grayMat = new cv::Mat(ScreenshotPool::getInstance()->acquire(rows, cols, CV_8UC1));
+        FeatureMatchingAlgorithm::toGrayscale(*screenshotMat).copyTo(*grayMat);
+        ScreenshotPool::getInstance()->release(*screenshotMat);
+        delete screenshotMat;
+        screenshotMat = grayMat;
+    }
+
+    screenData.pixels = (unsigned char*) screenshotMat->data;
+    screenData._data = (void*) screenshotMat;
+
     return screenData;
 }
 
 void clearCapturedScreenshotMemory(screenshot scrnsht) {
-    ((cv::Mat*) (scrnsht._data))->release();
+    cv::Mat* screenshotMat = (cv::Mat*) scrnsht._data;
+    ScreenshotPool::getInstance()->release(*screenshotMat);
+    delete screenshotMat;
 }
 
 void setActivationEnabled(bool activation) {
@@ -307,6 +321,38 @@ bool isWindowPartHidden(windowId wid,int x, int y, int width, int height) {
     return res;
 }
 
+// Return the bounds of the on screen windows above *wid* (i.e. the windows that can cover it)
+std::vector<windowRect> getWindowsAboveRects(windowId wid) {
+    std::vector<windowRect> rects;
+    NSArray *windows = (NSArray *)CGWindowListCopyWindowInfo(kCGWindowListOptionOnScreenAboveWindow, wid);
+
+    for (NSDictionary *window in windows) {
+        NSInteger windowLayer = [[window objectForKey:(id)kCGWindowLayer] integerValue];
+        if (windowLayer < kCGScreenSaverWindowLevelKey) {
+            CGRect wndBounds;
+            CGRectMakeWithDictionaryRepresentation((CFDictionaryRef) [window objectForKey:(id)kCGWindowBounds], &wndBounds);
+
+            windowRect rect;
+            rect.x = wndBounds.origin.x;
+            rect.y = wndBounds.origin.y;
+            rect.width = wndBounds.size.width;
+            rect.height = wndBounds.size.height;
+            rects.push_back(rect);
+        }
+    }
+
+    CFRelease(windows);
+    return rects;
+}
+
+// The window server does not tell which windows are redrawn, they are captured periodically instead
+bool registerDamageCallback(__unused windowId wid) {
+    return false;
+}
+
+void freeRegisteredDamageCallback(__unused windowId wid) {
+}
+
 // Callback receiving all the system's events
 CGEventRef eventsCallback(__unused CGEventTapProxy proxy,
                              CGEventType type,
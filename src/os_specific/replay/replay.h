@@ -0,0 +1,27 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <QString>
+
+// The replay backend implements os_specific/window.h from a trace recorded with --record (see trace.h) instead of the desktop
+// The trace is replayed *speed* times faster than it was recorded, from the start of the event loop
+bool loadReplayTrace(QString path, double speed);
+
+#endif // REPLAY_H
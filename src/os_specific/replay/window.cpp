@@ -0,0 +1,362 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include <opencv2/opencv.hpp>
+#include <string>
+#include "../window.h"
+#include "../screenshotpool.h"
+#include "replay.h"
+#include "trace.h"
+#include "algorithms/featurematchingalgorithm.h"
+#include <QDebug>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <pthread.h>
+
+// The last screenshot of a window, only decoded when captured
+typedef struct _replayedFrame {
+    QRect rect;
+    QByteArray png;
+    cv::Mat image;
+} replayedFrame;
+
+static QString tracePath;
+static double replaySpeed = 1;
+static bool hasDamageEvents = false;
+static bool replayStarted = false;
+
+// Windows as of the last updates, only used by the main thread except for the occlusion queries
+static QMutex windowsMutex;
+static QList<windowId> stackingOrder; // From bottom to top
+static QHash<windowId, windowRect> visibleWindowsRects;
+static windowId activeWindow = 0;
+
+static QMutex framesMutex;
+static QHash<windowId, replayedFrame> frames;
+// Damage is replayed along with the next screenshot of the window, so that the capture it triggers sees the new pixels
+static QHash<windowId, QList<TraceEvent>> pendingDamage;
+
+static bool openTrace(QFile& file, QDataStream& stream) {
+    file.setFileName(tracePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    quint32 magic, version;
+    stream.setDevice(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream >> magic >> version;
+    return magic == TRACE_MAGIC && version == TRACE_VERSION;
+}
+
+bool loadReplayTrace(QString path, double speed) {
+    tracePath = path;
+    replaySpeed = speed > 0 ? speed : 1;
+
+    // Windows are only captured on damage if they were during the recording
+    QFile file;
+    QDataStream stream;
+    if (!openTrace(file, stream)) {
+        qWarning() << "Cannot read the trace" << path;
+        return false;
+    }
+
+    TraceEvent event;
+    int nbEvents = 0;
+    while (!stream.atEnd() && stream.status() == QDataStream::Ok) {
+        stream >> event;
+        hasDamageEvents |= event.type == WindowDamaged;
+        nbEvents++;
+    }
+    qDebug() << "Replaying" << nbEvents << "events at speed" << replaySpeed;
+
+    return stream.status() == QDataStream::Ok;
+}
+
+// Called from the main thread
+static void onReplayedWindowUpdated(TraceEvent event) {
+    windowsMutex.lock();
+    // The windows are listed from top to bottom, so the ones above this one are already known
+    stackingOrder.removeAll(event.wid);
+    stackingOrder.prepend(event.wid);
+    if (event.isOnScreen) {
+        windowRect rect;
+        rect.x = event.rect.x();
+        rect.y = event.rect.y();
+        rect.width = event.rect.width();
+        rect.height = event.rect.height();
+        visibleWindowsRects[event.wid] = rect;
+    } else {
+        visibleWindowsRects.remove(event.wid);
+    }
+    if (event.isFrontMost) {
+        activeWindow = event.wid;
+    }
+    windowsMutex.unlock();
+
+    onWindowUpdated(event.wid, event.pid, event.rect.x(), event.rect.y(), event.rect.width(), event.rect.height(), event.isOnScreen, event.text.constData(), event.isFrontMost);
+}
+
+static void onReplayedWindowDestroyed(windowId wid) {
+    windowsMutex.lock();
+    stackingOrder.removeAll(wid);
+    visibleWindowsRects.remove(wid);
+    windowsMutex.unlock();
+
+    framesMutex.lock();
+    frames.remove(wid);
+    framesMutex.unlock();
+
+    onWindowDestroyed(wid);
+}
+
+// Events are sent to the same threads as with the platform backends: the main thread, except for the files and the damage
+static void dispatch(const TraceEvent& event) {
+    switch (event.type) {
+    case WindowsListed:
+        QMetaObject::invokeMethod(qApp, []() {
+            windowsMutex.lock();
+            stackingOrder.clear();
+            windowsMutex.unlock();
+        }, Qt::QueuedConnection);
+        break;
+    case WindowUpdated:
+        QMetaObject::invokeMethod(qApp, [event]() {onReplayedWindowUpdated(event);}, Qt::QueuedConnection);
+        break;
+    case WindowScrolled:
+        QMetaObject::invokeMethod(qApp, [event]() {
+            onWindowScrolled(event.wid, event.scrollAreaId, event.rect.x(), event.rect.y(), event.rect.width(), event.rect.height(), event.horizontalPos, event.verticalPos);
+        }, Qt::QueuedConnection);
+        break;
+    case WindowDestroyed:
+        QMetaObject::invokeMethod(qApp, [event]() {onReplayedWindowDestroyed(event.wid);}, Qt::QueuedConnection);
+        break;
+    case WindowDamaged:
+        pendingDamage[event.wid].append(event);
+        break;
+    case FileOpened:
+        onFileOpened(event.text.constData(), event.pid);
+        break;
+    case MouseMoved:
+        QMetaObject::invokeMethod(qApp, [event]() {onMouseMoved(event.rect.x(), event.rect.y());}, Qt::QueuedConnection);
+        break;
+    case Screenshot: {
+        replayedFrame frame;
+        frame.rect = event.rect;
+        frame.png = event.image;
+        framesMutex.lock();
+        frames[event.wid] = frame;
+        framesMutex.unlock();
+
+        for (auto& damage : pendingDamage.take(event.wid)) {
+            onWindowDamaged(damage.wid, damage.rect.x(), damage.rect.y(), damage.rect.width(), damage.rect.height());
+        }
+        break;
+    }
+    }
+}
+
+static void* replayThread(void*) {
+    QFile file;
+    QDataStream stream;
+    if (!openTrace(file, stream)) {
+        return NULL;
+    }
+
+    QElapsedTimer clock;
+    clock.start();
+    while (!stream.atEnd() && stream.status() == QDataStream::Ok) {
+        TraceEvent event;
+        stream >> event;
+
+        qint64 wait = event.time / replaySpeed - clock.elapsed();
+        if (wait > 0) {
+            QThread::msleep(wait);
+        }
+        dispatch(event);
+    }
+
+    qDebug() << "Replay finished in" << clock.elapsed() << "ms";
+    QMetaObject::invokeMethod(qApp, []() {qApp->quit();}, Qt::QueuedConnection);
+    return NULL;
+}
+
+// The replay starts with the event loop, once the callbacks' receivers exist
+void initialize() {
+    if (replayStarted || tracePath.isEmpty()) {
+        return;
+    }
+    replayStarted = true;
+
+    QMetaObject::invokeMethod(qApp, []() {
+        pthread_t thread;
+        pthread_create(&thread, NULL, replayThread, NULL);
+        pthread_detach(thread);
+    }, Qt::QueuedConnection);
+}
+
+bool requestScreenCapturePermission() {
+    return true;
+}
+
+bool requestAccessibilityPermission() {
+    return true;
+}
+
+// Files opened during the recording are replayed as they were reported
+bool installFileOpenHook() {
+    return true;
+}
+
+void uninstallFileOpenHook() {
+}
+
+// The windows are updated as they were during the recording, by the replay thread
+void updateOpenedWindows() {
+}
+
+windowId getActiveWindow() {
+    windowsMutex.lock();
+    windowId wid = activeWindow;
+    windowsMutex.unlock();
+    return wid;
+}
+
+std::vector<windowRect> getWindowsAboveRects(windowId wid) {
+    std::vector<windowRect> rects;
+
+    windowsMutex.lock();
+    int index = stackingOrder.indexOf(wid);
+    if (index >= 0) {
+        for (int i = index + 1; i < stackingOrder.size(); ++i) {
+            if (visibleWindowsRects.contains(stackingOrder.at(i))) {
+                rects.push_back(visibleWindowsRects[stackingOrder.at(i)]);
+            }
+        }
+    }
+    windowsMutex.unlock();
+
+    return rects;
+}
+
+bool isWindowPartHidden(windowId wid, int x, int y, int width, int height) {
+    cv::Rect rect(x, y, width, height);
+    for (auto wndRect : getWindowsAboveRects(wid)) {
+        if ((rect & cv::Rect(wndRect.x, wndRect.y, wndRect.width, wndRect.height)).area() > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isWindowRectHidden(windowId wid, int x, int y, int width, int height) {
+    return isWindowPartHidden(wid, x, y, width, height);
+}
+
+// Returns the part of the last screenshot recorded for the window covering the requested screen rect
+screenshot captureScreenshot(windowId windowId, bool grayscale, int x, int y, int width, int height) {
+    screenshot screenData;
+    screenData.pixels = NULL;
+    screenData._data = NULL;
+    screenData.width = 0;
+    screenData.height = 0;
+    screenData.bits_per_pixels = 0;
+
+    framesMutex.lock();
+    if (!frames.contains(windowId)) {
+        framesMutex.unlock();
+        return screenData;
+    }
+    replayedFrame& frame = frames[windowId];
+    if (frame.image.empty()) {
+        // Decoded once for all the captures until the next screenshot of the window
+        frame.image = cv::imdecode(cv::Mat(1, frame.png.size(), CV_8U, (void*) frame.png.constData()), cv::IMREAD_UNCHANGED);
+    }
+    cv::Mat image = frame.image;
+    QRect rect = frame.rect;
+    framesMutex.unlock();
+
+    if (image.empty() || rect.width() <= 0 || rect.height() <= 0) {
+        return screenData;
+    }
+
+    // Screenshots can have a higher resolution than the screen (e.g. retina displays)
+    double scaleX = (double) image.cols / rect.width();
+    double scaleY = (double) image.rows / rect.height();
+    cv::Rect area(0, 0, image.cols, image.rows);
+    if (width > 0 && height > 0) {
+        area &= cv::Rect((x - rect.x()) * scaleX, (y - rect.y()) * scaleY, width * scaleX, height * scaleY);
+    }
+    if (area.empty()) {
+        return screenData;
+    }
+
+    cv::Mat source = image(area);
+    cv::Mat* screenshotMat = new cv::Mat(ScreenshotPool::getInstance()->acquire(area.height, area.width, grayscale ? CV_8UC1 : CV_8UC4));
+    if (source.channels() == (grayscale ? 1 : 4)) {
+        source.copyTo(*screenshotMat);
+    } else if (grayscale) {
+        FeatureMatchingAlgorithm::toGrayscale(source).copyTo(*screenshotMat);
+    } else {
+        cv::cvtColor(source, *screenshotMat, source.channels() == 1 ? cv::COLOR_GRAY2RGBA : cv::COLOR_RGB2RGBA);
+    }
+
+    screenData.pixels = screenshotMat->data;
+    screenData._data = (void*) screenshotMat;
+    screenData.width = area.width;
+    screenData.height = area.height;
+    screenData.bits_per_pixels = grayscale ? 8 : 32;
+
+    return screenData;
+}
+
+void clearCapturedScreenshotMemory(screenshot scrnsht) {
+    cv::Mat* screenshotMat = (cv::Mat*) scrnsht._data;
+    if (screenshotMat != NULL) {
+        ScreenshotPool::getInstance()->release(*screenshotMat);
+        delete screenshotMat;
+    }
+}
+
+std::vector<std::string> getActiveWindowFiles() {
+    return std::vector<std::string>();
+}
+
+void lookForOpenedFiles() {
+}
+
+void setActivationEnabled(bool) {
+}
+
+// Scrolling is replayed as it was reported during the recording
+bool registerScrollCallback(processId, windowId) {
+    return true;
+}
+
+void freeRegisteredScrollCallbacks() {
+}
+
+bool registerDamageCallback(windowId) {
+    return hasDamageEvents;
+}
+
+void freeRegisteredDamageCallback(windowId) {
+}
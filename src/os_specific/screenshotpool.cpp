@@ -0,0 +1,86 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include "screenshotpool.h"
+
+// Beyond this, released buffers are freed (the least recently released first)
+#define MAX_FREE_BYTES (128 * 1024 * 1024)
+// Buffers of the same size kept aside, enough for several windows of the same size
+#define MAX_FREE_BUFFERS_PER_SIZE 4
+
+ScreenshotPool::ScreenshotPool() :
+    freeBytes(0) {
+}
+
+ScreenshotPool* ScreenshotPool::getInstance() {
+    // Captures are done from the threads of the analysis, and the initialization of a local static is thread-safe
+    static ScreenshotPool pool;
+    return &pool;
+}
+
+// Returns a buffer of the given dimensions, which must be given back with release() once the screenshot is not needed anymore
+cv::Mat ScreenshotPool::acquire(int rows, int cols, int type) {
+    mutex.lock();
+    for (int i = 0; i < freeBuffers.size(); ++i) {
+        cv::Mat buffer = freeBuffers.at(i);
+        if (buffer.rows == rows && buffer.cols == cols && buffer.type() == type) {
+            freeBuffers.removeAt(i);
+            freeBytes -= buffer.total() * buffer.elemSize();
+            mutex.unlock();
+            return buffer;
+        }
+    }
+    mutex.unlock();
+
+    return cv::Mat(rows, cols, type);
+}
+
+// Give *buffer* back to the pool, *buffer* is released in any case
+void ScreenshotPool::release(cv::Mat& buffer) {
+    // A buffer still referenced by another Mat cannot be reused
+    // Neither can a buffer of the memory shared with the analyzer process, which goes back to its allocator
+    if (buffer.empty() || buffer.u == NULL || buffer.u->refcount > 1 || buffer.allocator != NULL) {
+        buffer.release();
+        return;
+    }
+
+    mutex.lock();
+    int nbSameSize = 0;
+    for (auto& freeBuffer : freeBuffers) {
+        nbSameSize += freeBuffer.size() == buffer.size() && freeBuffer.type() == buffer.type();
+    }
+
+    if (nbSameSize < MAX_FREE_BUFFERS_PER_SIZE) {
+        freeBuffers.prepend(buffer);
+        freeBytes += buffer.total() * buffer.elemSize();
+
+        while (freeBytes > MAX_FREE_BYTES && !freeBuffers.isEmpty()) {
+            cv::Mat oldest = freeBuffers.takeLast();
+            freeBytes -= oldest.total() * oldest.elemSize();
+        }
+    }
+    mutex.unlock();
+
+    buffer.release();
+}
+
+void ScreenshotPool::clear() {
+    mutex.lock();
+    freeBuffers.clear();
+    freeBytes = 0;
+    mutex.unlock();
+}
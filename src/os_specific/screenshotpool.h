@@ -0,0 +1,44 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#ifndef SCREENSHOTPOOL_H
+#define SCREENSHOTPOOL_H
+
+#include <QMutex>
+#include <QList>
+#include <opencv2/opencv.hpp>
+
+// Buffers of the captured screenshots, reused from one capture to the next instead of being allocated each time
+// Windows are captured again and again with the same size, so buffers are kept by dimensions
+// Each window holds at most two of them: the last screenshot and the one being captured (double buffering)
+class ScreenshotPool
+{
+public:
+    static ScreenshotPool* getInstance();
+    cv::Mat acquire(int rows, int cols, int type);
+    void release(cv::Mat& buffer);
+    void clear();
+
+private:
+    ScreenshotPool();
+
+    QMutex mutex;
+    QList<cv::Mat> freeBuffers; // The most recently released first
+    size_t freeBytes;
+};
+
+#endif // SCREENSHOTPOOL_H
@@ -31,6 +31,13 @@ typedef struct _screenshot {
     int bits_per_pixels;
 } screenshot;
 
+typedef struct _windowRect {
+    int x;
+    int y;
+    int width;
+    int height;
+} windowRect;
+
 // Functions
 void initialize();
 bool installFileOpenHook();
@@ -38,7 +45,8 @@ void uninstallFileOpenHook();
 bool requestScreenCapturePermission();
 bool requestAccessibilityPermission();
 void updateOpenedWindows();
-screenshot captureScreenshot(windowId windowId);
+// 8 bits per pixel if grayscale. Only the part of the window inside the x, y, width, height screen rect if width and height > 0
+screenshot captureScreenshot(windowId windowId, bool grayscale = false, int x = 0, int y = 0, int width = 0, int height = 0);
 void clearCapturedScreenshotMemory(screenshot scrnsht);
 bool isWindowRectHidden(windowId wid,int x, int y, int width, int height);
 std::vector<std::string> getActiveWindowFiles();
@@ -48,12 +56,19 @@ void setActivationEnabled(bool activation);
 bool registerScrollCallback(processId pid, windowId wid);
 void freeRegisteredScrollCallbacks();
 bool isWindowPartHidden(windowId wid, int x, int y, int width, int height);
+std::vector<windowRect> getWindowsAboveRects(windowId wid);
+// Returns false if the system does not report the parts of the window that are redrawn (the window then has to be captured periodically)
+bool registerDamageCallback(windowId wid);
+void freeRegisteredDamageCallback(windowId wid);
 
 // Callbacks
 void onFileOpened(const char* filePath, processId id);
 void onWindowUpdated(windowId wid, processId pid, int x, int y, int width, int height, bool isOnScreen, const char* title, bool isFrontMost);
-void onWindowScrolled(windowId wid, int x, int y, int width, int height, double horizontalPos, double verticalPos);
+// *scrollAreaId* identifies the scroll area among the ones of the window (a window can have several, e.g. a sidebar)
+void onWindowScrolled(windowId wid, unsigned long scrollAreaId, int x, int y, int width, int height, double horizontalPos, double verticalPos);
 void onWindowDestroyed(windowId id);
+// *x*, *y*, *width*, *height* are relative to the window. Can be called from any thread
+void onWindowDamaged(windowId wid, int x, int y, int width, int height);
 void onMouseMoved(int x, int y);
 
 
@@ -107,7 +107,11 @@ void RegistrationToolDialog::on_RegistrationToolDialog_accepted() {
     QString input = ui->augmentedFigureLineEdit->text();
     input = input.trimmed();
 
-    dataBase->saveFigureInDb(cvSelection, file, QUrl::fromUserInput(input));
+    // The whole window is kept as well, to recognize the document when its path cannot be obtained
+    QImage imgPage = screenshot.toImage().convertToFormat(QImage::Format_RGBA8888);
+    cv::Mat cvPage(imgPage.height(), imgPage.width(), CV_8UC4, (void *)imgPage.constBits(), imgPage.bytesPerLine());
+
+    dataBase->saveFigureInDb(cvSelection, file, QUrl::fromUserInput(input), cvPage);
     filesManager->addObservedFile(file);
 
     lookForOpenedFiles();
@@ -0,0 +1,470 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include "remoteanalyzer.h"
+#include "figurefindertask.h"
+#include "algorithms/featurematchingalgorithm.h"
+#include <QCoreApplication>
+#include <QGuiApplication>
+#include <QScreen>
+#include <QProcess>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSocketNotifier>
+#include <QDataStream>
+#include <QTimer>
+#include <QTextStream>
+#include <QDebug>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Slot size when no screen is known (1080p in RGBA)
+#define ANALYZER_DEFAULT_SLOT_SIZE ((size_t) 1920 * 1080 * 4)
+// Milliseconds to wait for the analyzer before analyzing the frame locally
+#define ANALYZER_TIMEOUT 2000
+// Beyond this, the analyzer keeps crashing and the frames are analyzed locally until Chameleon is restarted
+#define ANALYZER_MAX_RESTARTS 5
+#define ANALYZER_NICENESS 10
+
+SharedFrameAllocator::SharedFrameAllocator() :
+    memory(NULL), slotSize(0) {
+    for (int i = 0; i < ANALYZER_NB_SLOTS; ++i) {
+        usedSlots[i] = false;
+    }
+}
+
+cv::UMatData* SharedFrameAllocator::allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const {
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = 0; i < dims; ++i) {
+        total *= sizes[i];
+    }
+
+    int slot = -1;
+    if (memory != NULL && data == NULL && step != NULL && total <= slotSize) {
+        mutex.lock();
+        for (int i = 0; i < ANALYZER_NB_SLOTS && slot < 0; ++i) {
+            if (!usedSlots[i]) {
+                usedSlots[i] = true;
+                slot = i;
+            }
+        }
+        mutex.unlock();
+    }
+
+    if (slot < 0) {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    size_t elementsStep = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; --i) {
+        step[i] = elementsStep;
+        elementsStep *= sizes[i];
+    }
+
+    cv::UMatData* u = new cv::UMatData(this);
+    u->data = u->origdata = memory + (size_t) slot * slotSize;
+    u->size = total;
+    return u;
+}
+
+bool SharedFrameAllocator::allocate(cv::UMatData* data, cv::AccessFlag, cv::UMatUsageFlags) const {
+    return data != NULL;
+}
+
+void SharedFrameAllocator::deallocate(cv::UMatData* data) const {
+    if (data == NULL) {
+        return;
+    }
+
+    mutex.lock();
+    usedSlots[(data->origdata - memory) / slotSize] = false;
+    mutex.unlock();
+    delete data;
+}
+
+bool SharedFrameAllocator::contains(const uchar* data) const {
+    return memory != NULL && data >= memory && data < memory + getMemorySize();
+}
+
+// Messages are prefixed by their size, sockets of the analysis threads wait for them since these threads have no event loop
+static bool writeMessage(QLocalSocket* socket, const QByteArray& message) {
+    QByteArray header;
+    QDataStream(&header, QIODevice::WriteOnly) << (quint32) message.size();
+    socket->write(header);
+    socket->write(message);
+    while (socket->bytesToWrite() > 0) {
+        if (!socket->waitForBytesWritten(ANALYZER_TIMEOUT)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool readMessage(QLocalSocket* socket, QByteArray* message) {
+    while (socket->bytesAvailable() < (qint64) sizeof(quint32)) {
+        if (!socket->waitForReadyRead(ANALYZER_TIMEOUT)) {
+            return false;
+        }
+    }
+
+    quint32 size;
+    QDataStream(socket->read(sizeof(quint32))) >> size;
+    while (socket->bytesAvailable() < (qint64) size) {
+        if (!socket->waitForReadyRead(ANALYZER_TIMEOUT)) {
+            return false;
+        }
+    }
+    *message = socket->read(size);
+    return true;
+}
+
+// The shared memory's descriptor is only inherited by the analyzer, not by the other processes started by Chameleon (e.g. QtWebEngineProcess)
+class AnalyzerProcess : public QProcess
+{
+public:
+    AnalyzerProcess(int memoryFd) : memoryFd(memoryFd) {}
+
+protected:
+    // Runs in the analyzer process, between fork and exec
+    void setupChildProcess() override {
+        fcntl(memoryFd, F_SETFD, 0);
+    }
+
+private:
+    int memoryFd;
+};
+
+RemoteAnalyzer::RemoteAnalyzer() :
+    running(false), stopped(false), nbRestarts(0), process(NULL), memoryFd(-1) {
+    serverName = QString("chameleon-analyzer-%1").arg(QCoreApplication::applicationPid());
+    memoryName = QString("/chameleon-frames-%1").arg(QCoreApplication::applicationPid());
+}
+
+RemoteAnalyzer* RemoteAnalyzer::getInstance() {
+    static RemoteAnalyzer analyzer;
+    return &analyzer;
+}
+
+bool RemoteAnalyzer::createSharedMemory() {
+    if (allocator.getMemory() != NULL) {
+        return true;
+    }
+
+    int fd = shm_open(memoryName.toLocal8Bit().constData(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        qWarning() << "Cannot create the memory shared with the analyzer";
+        return false;
+    }
+    // The name is only needed to create the memory, it is reached through the descriptor inherited by the analyzer afterwards
+    // So nothing is left behind if Chameleon crashes
+    shm_unlink(memoryName.toLocal8Bit().constData());
+
+    // A slot holds the capture of the largest screen in RGBA and in pixels (twice its size in points on a retina screen)
+    // Larger frames (e.g. a window across several screens) are analyzed by Chameleon
+    size_t slotSize = 0;
+    for (QScreen* screen : QGuiApplication::screens()) {
+        QSize size = screen->size() * screen->devicePixelRatio();
+        slotSize = qMax(slotSize, (size_t) size.width() * size.height() * 4);
+    }
+    if (slotSize == 0) {
+        slotSize = ANALYZER_DEFAULT_SLOT_SIZE;
+    }
+    size_t memorySize = ANALYZER_NB_SLOTS * slotSize;
+
+    // With ftruncate only, the pages are reserved on first write, which raises SIGBUS if /dev/shm is too small (e.g. in containers)
+#ifdef __linux__
+    bool allocated = posix_fallocate(fd, 0, memorySize) == 0;
+#else
+    bool allocated = ftruncate(fd, memorySize) == 0;
+#endif
+    void* memory = MAP_FAILED;
+    if (allocated) {
+        memory = mmap(NULL, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (memory == MAP_FAILED) {
+        qWarning() << "Cannot map the memory shared with the analyzer";
+        close(fd);
+        return false;
+    }
+
+    // The descriptor keeps FD_CLOEXEC (set by shm_open), each (re)started analyzer inherits it through AnalyzerProcess
+    memoryFd = fd;
+    allocator.setMemory((uchar*) memory, slotSize);
+    return true;
+}
+
+// Must be called from the main thread
+// The analyzer is started asynchronously, frames being analyzed by Chameleon until it is ready
+bool RemoteAnalyzer::start() {
+    stopped = false;
+    if (process != NULL) {
+        return true;
+    }
+
+    if (!createSharedMemory()) {
+        return false;
+    }
+
+    QProcess* analyzer = new AnalyzerProcess(memoryFd);
+    process = analyzer;
+    analyzer->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+
+    // The analyzer writes a line once it is listening
+    QObject::connect(analyzer, &QProcess::readyReadStandardOutput, analyzer, [this, analyzer]() {
+        if (process == analyzer && !running && analyzer->canReadLine()) {
+            analyzer->readLine();
+            qDebug() << "Analyzer started";
+            running = true;
+        }
+    });
+
+    QObject::connect(analyzer, &QProcess::errorOccurred, analyzer, [this, analyzer](QProcess::ProcessError error) {
+        // Otherwise, the process is finished (or was never started) and finished() is emitted
+        if (error == QProcess::FailedToStart && process == analyzer) {
+            qWarning() << "The analyzer could not be started, frames are analyzed by Chameleon";
+            process = NULL;
+            analyzer->deleteLater();
+        }
+    });
+
+    QObject::connect(analyzer, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), analyzer, [this, analyzer](int, QProcess::ExitStatus) {
+        analyzer->deleteLater();
+        if (process != analyzer) {
+            return;
+        }
+        running = false;
+        process = NULL;
+        if (stopped) {
+            return;
+        }
+
+        qWarning() << "The analyzer stopped, frames are analyzed by Chameleon until it is restarted";
+        if (++nbRestarts <= ANALYZER_MAX_RESTARTS) {
+            QTimer::singleShot(1000, qApp, [this]() {
+                if (!stopped) {
+                    start();
+                }
+            });
+        }
+    });
+
+    // An analyzer that never gets ready is killed, and restarted like if it crashed
+    QTimer::singleShot(5 * ANALYZER_TIMEOUT, analyzer, [this, analyzer]() {
+        if (process == analyzer && !running) {
+            analyzer->kill();
+        }
+    });
+
+    analyzer->start(QCoreApplication::applicationFilePath(), {"--analyzer", serverName, "--analyzer-memory", QString::number(memoryFd)});
+    return true;
+}
+
+// Must be called from the main thread
+void RemoteAnalyzer::stop() {
+    stopped = true;
+    running = false;
+    if (process != NULL) {
+        process->kill();
+        process->waitForFinished(ANALYZER_TIMEOUT);
+    }
+}
+
+// Returns a frame allocated in the memory shared with the analyzer if it is running and has a free slot
+cv::Mat RemoteAnalyzer::allocateFrame(int rows, int cols, int type) {
+    cv::Mat frame;
+    if (running) {
+        frame.allocator = &allocator;
+    }
+    frame.create(rows, cols, type);
+    return frame;
+}
+
+QLocalSocket* RemoteAnalyzer::getSocket() {
+    if (!sockets.hasLocalData()) {
+        sockets.setLocalData(new QLocalSocket());
+    }
+
+    QLocalSocket* socket = sockets.localData();
+    if (socket->state() != QLocalSocket::ConnectedState) {
+        socket->abort();
+        socket->connectToServer(serverName);
+        if (!socket->waitForConnected(ANALYZER_TIMEOUT)) {
+            return NULL;
+        }
+    }
+    return socket;
+}
+
+// Detects and describes the keypoints of *image* (only in *regions* if not empty) in the analyzer
+// Returns false if the analyzer could not do it, in which case the caller must analyze the image itself
+bool RemoteAnalyzer::detectAndCompute(cv::Mat image, cv::Mat mask, const std::vector<cv::Rect>& regions, int nbTiles, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) {
+    if (!running || image.empty() || !allocator.contains(image.data)) {
+        return false;
+    }
+
+    // The mask is computed after the capture, so it usually has to be copied in a slot too
+    cv::Mat sharedMask = mask;
+    if (!mask.empty() && !allocator.contains(mask.data)) {
+        sharedMask = allocateFrame(mask.rows, mask.cols, mask.type());
+        if (!allocator.contains(sharedMask.data)) {
+            return false;
+        }
+        mask.copyTo(sharedMask);
+    }
+
+    QLocalSocket* socket = getSocket();
+    if (socket == NULL) {
+        return false;
+    }
+
+    QByteArray request;
+    QDataStream out(&request, QIODevice::WriteOnly);
+    out << (quint64) (image.data - allocator.getMemory()) << (quint64) image.step[0] << image.rows << image.cols << image.type();
+    out << (qint64) (sharedMask.empty() ? -1 : sharedMask.data - allocator.getMemory());
+    out << nbTiles << (quint32) regions.size();
+    for (auto& region : regions) {
+        out << region.x << region.y << region.width << region.height;
+    }
+
+    QByteArray reply;
+    if (!writeMessage(socket, request) || !readMessage(socket, &reply)) {
+        // A late reply would be taken for the reply of the next request
+        socket->abort();
+        return false;
+    }
+
+    QDataStream in(reply);
+    quint32 nbKeypoints;
+    in >> nbKeypoints;
+    keypoints.resize(nbKeypoints);
+    for (auto& keypoint : keypoints) {
+        in >> keypoint.pt.x >> keypoint.pt.y >> keypoint.size >> keypoint.angle >> keypoint.response >> keypoint.octave >> keypoint.class_id;
+    }
+
+    int rows, cols, type;
+    QByteArray data;
+    in >> rows >> cols >> type >> data;
+    descriptors = rows > 0 ? cv::Mat(rows, cols, type, data.data()).clone() : cv::Mat();
+
+    return in.status() == QDataStream::Ok;
+}
+
+static QByteArray analyze(uchar* memory, size_t memorySize, const QByteArray& request) {
+    QDataStream in(request);
+    quint64 offset, step;
+    qint64 maskOffset;
+    int rows, cols, type, nbTiles;
+    quint32 nbRegions;
+    in >> offset >> step >> rows >> cols >> type >> maskOffset >> nbTiles >> nbRegions;
+
+    std::vector<cv::Rect> regions(in.status() == QDataStream::Ok ? nbRegions : 0);
+    for (auto& region : regions) {
+        in >> region.x >> region.y >> region.width >> region.height;
+    }
+
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+    // Offsets come from another process, so they are checked before reading the shared memory
+    bool valid = in.status() == QDataStream::Ok && rows > 0 && cols > 0 && offset + step * rows <= memorySize
+            && (maskOffset < 0 || (quint64) maskOffset + (quint64) rows * cols <= memorySize);
+    if (valid) {
+        cv::Mat image(rows, cols, type, memory + offset, step);
+        cv::Mat mask = maskOffset >= 0 ? cv::Mat(rows, cols, CV_8U, memory + maskOffset) : cv::Mat();
+        FigureFinderTask::featureMatchingAlgorithm->setNbTiles(nbTiles);
+        if (regions.empty()) {
+            FigureFinderTask::featureMatchingAlgorithm->detectAndCompute(image, keypoints, descriptors, mask);
+        } else {
+            FigureFinderTask::featureMatchingAlgorithm->detectAndComputeInRegions(image, regions, keypoints, descriptors, mask);
+        }
+    }
+
+    QByteArray reply;
+    QDataStream out(&reply, QIODevice::WriteOnly);
+    out << (quint32) keypoints.size();
+    for (auto& keypoint : keypoints) {
+        out << keypoint.pt.x << keypoint.pt.y << keypoint.size << keypoint.angle << keypoint.response << keypoint.octave << keypoint.class_id;
+    }
+
+    descriptors = descriptors.isContinuous() ? descriptors : descriptors.clone();
+    out << descriptors.rows << descriptors.cols << descriptors.type();
+    out << QByteArray((const char*) descriptors.data, descriptors.total() * descriptors.elemSize());
+    return reply;
+}
+
+int runAnalyzer(QString serverName, int memoryFd) {
+    // The analysis must not compete with the interface for the CPU
+    if (nice(ANALYZER_NICENESS) == -1) {
+        qWarning() << "Cannot lower the priority of the analyzer";
+    }
+
+    // The size of the memory depends on the screens of Chameleon's session
+    struct stat memoryStat;
+    size_t memorySize = fstat(memoryFd, &memoryStat) == 0 ? memoryStat.st_size : 0;
+    void* memory = memorySize > 0 ? mmap(NULL, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFd, 0) : MAP_FAILED;
+    close(memoryFd);
+    if (memory == MAP_FAILED) {
+        qWarning() << "Cannot map the memory shared with Chameleon";
+        return 1;
+    }
+
+    QLocalServer server;
+    QLocalServer::removeServer(serverName);
+    if (!server.listen(serverName)) {
+        qWarning() << "The analyzer cannot listen on" << serverName;
+        return 1;
+    }
+
+    // Each analysis thread of Chameleon has its own connection, and waits for the reply before sending another request
+    QObject::connect(&server, &QLocalServer::newConnection, [&server, memory, memorySize]() {
+        while (server.hasPendingConnections()) {
+            QLocalSocket* socket = server.nextPendingConnection();
+            QObject::connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+            QObject::connect(socket, &QLocalSocket::readyRead, [socket, memory, memorySize]() {
+                while (socket->bytesAvailable() >= (qint64) sizeof(quint32)) {
+                    quint32 size;
+                    QDataStream(socket->peek(sizeof(quint32))) >> size;
+                    if (socket->bytesAvailable() < (qint64) (sizeof(quint32) + size)) {
+                        break;
+                    }
+                    socket->read(sizeof(quint32));
+                    QByteArray reply = analyze((uchar*) memory, memorySize, socket->read(size));
+
+                    QByteArray header;
+                    QDataStream(&header, QIODevice::WriteOnly) << (quint32) reply.size();
+                    socket->write(header);
+                    socket->write(reply);
+                }
+            });
+        }
+    });
+
+    // Chameleon keeps our standard input open, so it is closed if Chameleon exits without stopping us (e.g. if it crashed)
+    QSocketNotifier parentNotifier(STDIN_FILENO, QSocketNotifier::Read);
+    QObject::connect(&parentNotifier, &QSocketNotifier::activated, [&parentNotifier]() {
+        char buffer[64];
+        if (read(STDIN_FILENO, buffer, sizeof(buffer)) <= 0) {
+            parentNotifier.setEnabled(false);
+            QCoreApplication::quit();
+        }
+    });
+
+    QTextStream(stdout) << "ready\n";
+    return QCoreApplication::exec();
+}
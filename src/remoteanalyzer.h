@@ -0,0 +1,86 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#ifndef REMOTEANALYZER_H
+#define REMOTEANALYZER_H
+
+#include <QMutex>
+#include <QString>
+#include <QThreadStorage>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+class QProcess;
+class QLocalSocket;
+
+// The memory shared with the analyzer process is split in slots, each holding a frame (or a mask) as large as the largest screen
+#define ANALYZER_NB_SLOTS 6
+
+// Allocates the frames in the free slots of the shared memory, or in the memory of the process if there is none or if the frame is too large
+class SharedFrameAllocator : public cv::MatAllocator
+{
+public:
+    SharedFrameAllocator();
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+    bool contains(const uchar* data) const;
+    inline void setMemory(uchar* memory, size_t slotSize) {this->memory = memory; this->slotSize = slotSize;}
+    inline uchar* getMemory() const {return memory;}
+    inline size_t getMemorySize() const {return ANALYZER_NB_SLOTS * slotSize;}
+
+private:
+    uchar* memory;
+    size_t slotSize;
+    mutable QMutex mutex;
+    mutable bool usedSlots[ANALYZER_NB_SLOTS];
+};
+
+// Detects the keypoints of the frames in a separate process (Chameleon --analyzer) running with a lower priority,
+// so that the analysis neither slows down nor crashes the interface
+// Frames are captured directly in the memory shared with this process, and their keypoints come back through a local socket (one per analysis thread)
+// Whenever the analyzer is not available, the frames are analyzed by the calling thread as before
+class RemoteAnalyzer
+{
+public:
+    static RemoteAnalyzer* getInstance();
+    bool start();
+    void stop();
+    cv::Mat allocateFrame(int rows, int cols, int type);
+    bool detectAndCompute(cv::Mat image, cv::Mat mask, const std::vector<cv::Rect>& regions, int nbTiles, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors);
+    inline bool isRunning() {return running;}
+
+private:
+    RemoteAnalyzer();
+    bool createSharedMemory();
+    QLocalSocket* getSocket();
+
+    bool running;
+    bool stopped;
+    int nbRestarts;
+    QProcess* process;
+    QString serverName;
+    QString memoryName;
+    int memoryFd;
+    SharedFrameAllocator allocator;
+    QThreadStorage<QLocalSocket*> sockets;
+};
+
+// Main of the analyzer process
+int runAnalyzer(QString serverName, int memoryFd);
+
+#endif // REMOTEANALYZER_H
@@ -0,0 +1,153 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include "trace.h"
+#include <QDebug>
+
+QDataStream& operator<<(QDataStream& stream, const TraceEvent& event) {
+    stream << (quint8) event.type << event.time;
+
+    switch (event.type) {
+    case WindowsListed:
+        break;
+    case WindowUpdated:
+        stream << (quint32) event.wid << (quint64) event.pid << event.rect << event.isOnScreen << event.isFrontMost << event.text;
+        break;
+    case WindowScrolled:
+        stream << (quint32) event.wid << (quint64) event.scrollAreaId << event.rect << event.horizontalPos << event.verticalPos;
+        break;
+    case WindowDestroyed:
+        stream << (quint32) event.wid;
+        break;
+    case WindowDamaged:
+        stream << (quint32) event.wid << event.rect;
+        break;
+    case FileOpened:
+        stream << (quint64) event.pid << event.text;
+        break;
+    case MouseMoved:
+        stream << event.rect.topLeft();
+        break;
+    case Screenshot:
+        stream << (quint32) event.wid << event.rect << event.image;
+        break;
+    }
+
+    return stream;
+}
+
+QDataStream& operator>>(QDataStream& stream, TraceEvent& event) {
+    quint8 type;
+    quint32 wid = 0;
+    quint64 id = 0;
+    stream >> type >> event.time;
+    event.type = (TraceEventType) type;
+
+    switch (event.type) {
+    case WindowsListed:
+        break;
+    case WindowUpdated:
+        stream >> wid >> id >> event.rect >> event.isOnScreen >> event.isFrontMost >> event.text;
+        event.pid = id;
+        break;
+    case WindowScrolled:
+        stream >> wid >> id >> event.rect >> event.horizontalPos >> event.verticalPos;
+        event.scrollAreaId = id;
+        break;
+    case WindowDestroyed:
+        stream >> wid;
+        break;
+    case WindowDamaged:
+        stream >> wid >> event.rect;
+        break;
+    case FileOpened:
+        stream >> id >> event.text;
+        event.pid = id;
+        break;
+    case MouseMoved: {
+        QPoint position;
+        stream >> position;
+        event.rect = QRect(position, QSize(1, 1));
+        break;
+    }
+    case Screenshot:
+        stream >> wid >> event.rect >> event.image;
+        break;
+    default:
+        stream.setStatus(QDataStream::ReadCorruptData);
+    }
+    event.wid = wid;
+
+    return stream;
+}
+
+TraceRecorder* TraceRecorder::getInstance() {
+    static TraceRecorder instance;
+    return &instance;
+}
+
+TraceRecorder::TraceRecorder() :
+    recording(false) {
+}
+
+bool TraceRecorder::start(QString path) {
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot write the trace" << path;
+        return false;
+    }
+
+    stream.setDevice(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << (quint32) TRACE_MAGIC << (quint32) TRACE_VERSION;
+    clock.start();
+    recording = true;
+    return true;
+}
+
+void TraceRecorder::stop() {
+    mutex.lock();
+    if (recording) {
+        recording = false;
+        stream.setDevice(NULL);
+        file.close();
+    }
+    mutex.unlock();
+}
+
+void TraceRecorder::record(TraceEvent event) {
+    mutex.lock();
+    if (recording) {
+        event.time = clock.elapsed();
+        stream << event;
+    }
+    mutex.unlock();
+}
+
+// *rect* is the part of the screen captured in *image*. Only the screenshots that changed need to be recorded
+void TraceRecorder::recordScreenshot(windowId wid, QRect rect, cv::Mat image) {
+    TraceEvent event(Screenshot);
+    event.wid = wid;
+    event.rect = rect;
+
+    // Compressed by the capturing thread, outside of the lock. A low compression level is already several times smaller
+    std::vector<uchar> png;
+    cv::imencode(".png", image, png, {cv::IMWRITE_PNG_COMPRESSION, 1});
+    event.image = QByteArray((const char*) png.data(), png.size());
+
+    record(event);
+}
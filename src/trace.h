@@ -0,0 +1,87 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QRect>
+#include <opencv2/opencv.hpp>
+#include "os_specific/window.h"
+
+#define TRACE_MAGIC 0x43485452 // "CHTR"
+#define TRACE_VERSION 1
+
+// What the platform backend told Chameleon during a session (see os_specific/window.h), to replay it with the replay backend
+enum TraceEventType : quint8 {
+    WindowsListed, // updateOpenedWindows was called, the next WindowUpdated events are the windows from top to bottom
+    WindowUpdated,
+    WindowScrolled,
+    WindowDestroyed,
+    WindowDamaged,
+    FileOpened,
+    MouseMoved,
+    Screenshot
+};
+
+// Only the fields of its type are saved
+struct TraceEvent {
+    TraceEventType type;
+    qint64 time; // ms since the start of the recording
+    windowId wid;
+    processId pid;
+    QRect rect; // Of the window, scroll area, damaged part or screenshot, on screen (relative to the window when damaged)
+    bool isOnScreen;
+    bool isFrontMost;
+    unsigned long scrollAreaId;
+    double horizontalPos;
+    double verticalPos;
+    QByteArray text; // Title of the window or path of the file
+    QByteArray image; // PNG of the screenshot
+
+    TraceEvent(TraceEventType type = WindowsListed) : type(type), time(0), wid(0), pid(0), isOnScreen(false), isFrontMost(false),
+        scrollAreaId(0), horizontalPos(0), verticalPos(0) {}
+};
+
+QDataStream& operator<<(QDataStream& stream, const TraceEvent& event);
+QDataStream& operator>>(QDataStream& stream, TraceEvent& event);
+
+// Writes the events of the session to a trace, from any thread
+class TraceRecorder
+{
+public:
+    static TraceRecorder* getInstance();
+    bool start(QString path);
+    void stop();
+    void record(TraceEvent event);
+    void recordScreenshot(windowId wid, QRect rect, cv::Mat image);
+    inline bool isRecording() {return recording;}
+
+private:
+    TraceRecorder();
+
+    bool recording;
+    QMutex mutex;
+    QFile file;
+    QDataStream stream;
+    QElapsedTimer clock;
+};
+
+#endif // TRACE_H
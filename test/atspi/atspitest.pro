@@ -0,0 +1,23 @@
+# Tests of the AT-SPI listener, run them with run.sh (they need a private D-Bus session, Xvfb and GTK 3 for Python)
+
+QT += testlib dbus
+QT -= gui
+
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_atspilistener
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ../../src/
+
+SOURCES += \
+    tst_atspilistener.cpp \
+    ../../src/os_specific/linux/atspilistener.cpp
+
+HEADERS += \
+    ../../src/os_specific/window.h \
+    ../../src/os_specific/linux/accessibility.h \
+    ../../src/os_specific/linux/atspilistener.h
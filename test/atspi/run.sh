@@ -0,0 +1,9 @@
+#!/bin/sh
+# Builds the tests of the AT-SPI listener and runs them in a private D-Bus session, whose accessibility bus is started on demand
+# The GTK application they observe (scrollapp.py, needs python3-gi, GTK 3 and at-spi2-core) is shown on a virtual X server (Xvfb)
+set -e
+cd "$(dirname "$0")"
+qmake atspitest.pro
+make
+unset NO_AT_BRIDGE
+xvfb-run -a dbus-run-session -- ./tst_atspilistener "$@"
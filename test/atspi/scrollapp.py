@@ -0,0 +1,27 @@
+#!/usr/bin/env python3
+# GTK application used by the AT-SPI tests: its document scrolls down by 20 pixels every 100 ms
+import gi
+gi.require_version("Gtk", "3.0")
+from gi.repository import Gtk, GLib
+
+window = Gtk.Window(title="Scrolled document")
+window.set_default_size(400, 300)
+window.connect("destroy", Gtk.main_quit)
+
+# Wrapped in a viewport by the scrolled window, whose accessible is the scroll pane of the scroll bars
+document = Gtk.DrawingArea()
+document.set_size_request(400, 100000)
+scrolledWindow = Gtk.ScrolledWindow()
+scrolledWindow.add(document)
+window.add(scrolledWindow)
+
+
+def scroll():
+    adjustment = scrolledWindow.get_vadjustment()
+    adjustment.set_value(adjustment.get_value() + 20)
+    return True
+
+
+GLib.timeout_add(100, scroll)
+window.show_all()
+Gtk.main()
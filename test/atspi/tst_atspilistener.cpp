@@ -0,0 +1,133 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include <QtTest>
+#include <QProcess>
+#include <QRect>
+#include "os_specific/window.h"
+#include "os_specific/linux/accessibility.h"
+#include "os_specific/linux/atspilistener.h"
+
+// Checks the AT-SPI listener against a GTK application scrolling continuously (scrollapp.py)
+// Run in a private D-Bus session (see run.sh), whose accessibility bus only has this application
+
+// The listener does not know the X11 windows, any id does as long as the process has only one observed window
+#define TEST_WID 1
+#define REPORT_TIMEOUT 15000
+
+struct ScrollReport {
+    windowId wid;
+    unsigned long scrollAreaId;
+    QRect rect;
+    double horizontalPos;
+    double verticalPos;
+};
+
+static QList<ScrollReport> reports;
+
+// Callbacks implemented by ObservedWindowsManager in Chameleon
+void onFileOpened(const char*, processId) {
+}
+
+void onWindowScrolled(windowId wid, unsigned long scrollAreaId, int x, int y, int width, int height, double horizontalPos, double verticalPos) {
+    ScrollReport report;
+    report.wid = wid;
+    report.scrollAreaId = scrollAreaId;
+    report.rect = QRect(x, y, width, height);
+    report.horizontalPos = horizontalPos;
+    report.verticalPos = verticalPos;
+    reports.append(report);
+}
+
+// Implemented by the X11 backend, only used to tell apart the windows of a process
+bool getWindowRect(windowId, windowRect*) {
+    return false;
+}
+
+class TestAtspiListener : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void reportsTheScrolling();
+    void forgetsTheClosedWindows();
+    void ignoresTheUnobservedProcesses();
+    void cleanupTestCase();
+
+private:
+    QProcess application;
+};
+
+void TestAtspiListener::initTestCase() {
+    QVERIFY2(AtspiListener::getInstance()->connectToBus(), "No accessibility bus, run the test with run.sh");
+
+    // Started once the accessibility is enabled, otherwise GTK does not expose its widgets
+    application.setProcessChannelMode(QProcess::ForwardedChannels);
+    application.start("python3", {QFINDTESTDATA("scrollapp.py")});
+    QVERIFY(application.waitForStarted());
+
+    AtspiListener::getInstance()->observeWindow(application.processId(), TEST_WID);
+}
+
+// The first events only serve to find the process, the scroll bar and its scroll pane, then each one is reported
+void TestAtspiListener::reportsTheScrolling() {
+    QTRY_VERIFY_WITH_TIMEOUT(reports.size() >= 5, REPORT_TIMEOUT);
+
+    // Positions are relative to the first value received
+    QCOMPARE(reports.first().verticalPos, 0.0);
+    for (int i = 0; i < reports.size(); ++i) {
+        QCOMPARE(reports.at(i).wid, (windowId) TEST_WID);
+        QCOMPARE(reports.at(i).scrollAreaId, reports.first().scrollAreaId);
+        QVERIFY(!reports.at(i).rect.isEmpty());
+        QCOMPARE(reports.at(i).horizontalPos, 0.0);
+        // A scroll area can be reported again when its extents changed
+        if (i > 0) {
+            QVERIFY(reports.at(i).verticalPos >= reports.at(i - 1).verticalPos);
+        }
+    }
+    QVERIFY(reports.last().verticalPos > 0);
+}
+
+// The scroll areas of the window are dropped, so they are found again (with a new origin) once it is observed again
+void TestAtspiListener::forgetsTheClosedWindows() {
+    AtspiListener::getInstance()->forgetWindow(TEST_WID);
+    reports.clear();
+    QTest::qWait(1000);
+    QVERIFY(reports.isEmpty());
+
+    AtspiListener::getInstance()->observeWindow(application.processId(), TEST_WID);
+    QTRY_VERIFY_WITH_TIMEOUT(!reports.isEmpty(), REPORT_TIMEOUT);
+    QCOMPARE(reports.first().verticalPos, 0.0);
+}
+
+void TestAtspiListener::ignoresTheUnobservedProcesses() {
+    AtspiListener::getInstance()->forgetWindows();
+    AtspiListener::getInstance()->observeWindow(application.processId() + 1, TEST_WID);
+    reports.clear();
+    QTest::qWait(2000);
+    QVERIFY(reports.isEmpty());
+}
+
+void TestAtspiListener::cleanupTestCase() {
+    AtspiListener::getInstance()->forgetWindows();
+    application.kill();
+    application.waitForFinished();
+}
+
+QTEST_GUILESS_MAIN(TestAtspiListener)
+#include "tst_atspilistener.moc"
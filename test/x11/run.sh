@@ -0,0 +1,8 @@
+#!/bin/sh
+# Builds the tests of the X11 backend and runs them on a virtual X server (Xvfb), without window manager
+# The screen must be 24 bits deep, xvfb-run starts an 8 bits one by default
+set -e
+cd "$(dirname "$0")"
+qmake x11test.pro
+make
+xvfb-run -a -s "-screen 0 1024x768x24" ./tst_x11window "$@"
@@ -0,0 +1,278 @@
+/* Copyright 2020 Damien Masson, Sylvain Malacria, Edward Lank, Géry Casiez
+               (University of Waterloo, Université de Lille, Inria, France)
+
+This file is part of Chameleon.
+
+Chameleon is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Chameleon is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Chameleon.  If not, see <https://www.gnu.org/licenses/>. */
+#include <QtTest>
+#include <QHash>
+#include <QSet>
+#include <QRect>
+#include <opencv2/opencv.hpp>
+#include <unistd.h>
+#include "os_specific/window.h"
+#include "os_specific/linux/accessibility.h"
+// X11 comes last, its macros (None, Bool, Status...) clash with Qt's headers
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+
+// Checks the X11 backend against an X server without window manager (e.g. Xvfb, see run.sh)
+// The test creates its windows and maintains the EWMH properties of the root window itself
+
+struct UpdatedWindow {
+    processId pid;
+    QRect rect;
+    bool onScreen;
+    QString title;
+    bool frontMost;
+};
+
+static QHash<windowId, UpdatedWindow> updatedWindows;
+static QSet<windowId> destroyedWindows;
+
+// Callbacks implemented by ObservedWindowsManager in Chameleon
+void onFileOpened(const char*, processId) {
+}
+
+void onWindowUpdated(windowId wid, processId pid, int x, int y, int width, int height, bool isOnScreen, const char* title, bool isFrontMost) {
+    UpdatedWindow window;
+    window.pid = pid;
+    window.rect = QRect(x, y, width, height);
+    window.onScreen = isOnScreen;
+    window.title = QString::fromUtf8(title);
+    window.frontMost = isFrontMost;
+    updatedWindows[wid] = window;
+}
+
+void onWindowScrolled(windowId, unsigned long, int, int, int, int, double, double) {
+}
+
+void onWindowDestroyed(windowId wid) {
+    destroyedWindows.insert(wid);
+}
+
+void onWindowDamaged(windowId, int, int, int, int) {
+}
+
+void onMouseMoved(int, int) {
+}
+
+class TestX11Window : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void listsTheWindows();
+    void capturesTheWindows();
+    void capturesPartOfAWindow();
+    void capturesInGrayscale();
+    void findsTheOccludedParts();
+    void ignoresTheUnmappedWindows();
+    void reportsTheClosedWindows();
+    void capturesTheWindowsPartlyOffScreen();
+    void cleanupTestCase();
+
+private:
+    Window createWindow(int x, int y, int width, int height, unsigned long color, const char* title);
+    void setClientList(QList<Window> windows, Window active);
+    void refresh();
+
+    Display* dpy;
+    Window bottom;
+    Window top;
+};
+
+Window TestX11Window::createWindow(int x, int y, int width, int height, unsigned long color, const char* title) {
+    Window window = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), x, y, width, height, 0, 0, color);
+
+    long pid = getpid();
+    XChangeProperty(dpy, window, XInternAtom(dpy, "_NET_WM_PID", False), XA_CARDINAL, 32, PropModeReplace, (unsigned char*) &pid, 1);
+    XChangeProperty(dpy, window, XInternAtom(dpy, "_NET_WM_NAME", False), XInternAtom(dpy, "UTF8_STRING", False), 8, PropModeReplace, (unsigned char*) title, strlen(title));
+    XMapWindow(dpy, window);
+
+    return window;
+}
+
+// What a window manager would do, *windows* being from bottom to top
+void TestX11Window::setClientList(QList<Window> windows, Window active) {
+    Window root = DefaultRootWindow(dpy);
+    std::vector<long> clients(windows.begin(), windows.end());
+    long activeWindow = active;
+
+    XChangeProperty(dpy, root, XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", False), XA_WINDOW, 32, PropModeReplace, (unsigned char*) clients.data(), clients.size());
+    XChangeProperty(dpy, root, XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False), XA_WINDOW, 32, PropModeReplace, (unsigned char*) &activeWindow, 1);
+    XSync(dpy, False);
+}
+
+void TestX11Window::refresh() {
+    updatedWindows.clear();
+    updateOpenedWindows();
+}
+
+void TestX11Window::initTestCase() {
+    dpy = XOpenDisplay(NULL);
+    QVERIFY2(dpy != NULL, "No X server, run the test with run.sh");
+    QVERIFY2(DefaultDepth(dpy, DefaultScreen(dpy)) == 24, "The X server must have a 24 bits screen");
+
+    // The top window hides the bottom right corner of the bottom window
+    bottom = createWindow(0, 0, 200, 150, 0xff0000, "Bottom window");
+    top = createWindow(150, 100, 100, 100, 0x0000ff, "Top window");
+    setClientList({bottom, top}, top);
+
+    QVERIFY(requestScreenCapturePermission());
+}
+
+void TestX11Window::listsTheWindows() {
+    refresh();
+
+    QVERIFY(updatedWindows.contains(bottom));
+    QVERIFY(updatedWindows.contains(top));
+
+    UpdatedWindow window = updatedWindows.value(bottom);
+    QCOMPARE(window.pid, (processId) getpid());
+    QCOMPARE(window.rect, QRect(0, 0, 200, 150));
+    QCOMPARE(window.title, QString("Bottom window"));
+    QVERIFY(window.onScreen);
+    QVERIFY(!window.frontMost);
+
+    window = updatedWindows.value(top);
+    QCOMPARE(window.rect, QRect(150, 100, 100, 100));
+    QCOMPARE(window.title, QString("Top window"));
+    QVERIFY(window.frontMost);
+
+    QCOMPARE(getActiveWindow(), (windowId) top);
+    QCOMPARE(getWindowPid(bottom), (processId) getpid());
+}
+
+void TestX11Window::capturesTheWindows() {
+    screenshot capture = captureScreenshot(bottom);
+    QCOMPARE(capture.width, 200u);
+    QCOMPARE(capture.height, 150u);
+    QCOMPARE(capture.bits_per_pixels, 32);
+
+    // In RGBA, whatever the order of the channels in the X server's memory
+    cv::Mat image(capture.height, capture.width, CV_8UC4, capture.pixels);
+    QVERIFY(image.at<cv::Vec4b>(10, 10) == cv::Vec4b(255, 0, 0, 255));
+    QVERIFY(image.at<cv::Vec4b>(140, 140) == cv::Vec4b(255, 0, 0, 255));
+    clearCapturedScreenshotMemory(capture);
+
+    capture = captureScreenshot(top);
+    QCOMPARE(capture.width, 100u);
+    QCOMPARE(capture.height, 100u);
+    image = cv::Mat(capture.height, capture.width, CV_8UC4, capture.pixels);
+    QVERIFY(image.at<cv::Vec4b>(50, 50) == cv::Vec4b(0, 0, 255, 255));
+    clearCapturedScreenshotMemory(capture);
+}
+
+// The rect is in screen coordinates, and clipped to the window
+void TestX11Window::capturesPartOfAWindow() {
+    screenshot capture = captureScreenshot(bottom, false, 100, 50, 40, 30);
+    QCOMPARE(capture.width, 40u);
+    QCOMPARE(capture.height, 30u);
+    clearCapturedScreenshotMemory(capture);
+
+    capture = captureScreenshot(top, false, 200, 50, 100, 100);
+    QCOMPARE(capture.width, 50u);
+    QCOMPARE(capture.height, 50u);
+    cv::Mat image(capture.height, capture.width, CV_8UC4, capture.pixels);
+    QVERIFY(image.at<cv::Vec4b>(0, 0) == cv::Vec4b(0, 0, 255, 255));
+    clearCapturedScreenshotMemory(capture);
+
+    capture = captureScreenshot(bottom, false, 500, 500, 10, 10);
+    QCOMPARE(capture.width, 0u);
+}
+
+// Same luminance as FeatureMatchingAlgorithm::toGrayscale on the color capture
+void TestX11Window::capturesInGrayscale() {
+    screenshot colorCapture = captureScreenshot(bottom);
+    cv::Mat expected;
+    cv::cvtColor(cv::Mat(colorCapture.height, colorCapture.width, CV_8UC4, colorCapture.pixels), expected, cv::COLOR_BGRA2GRAY);
+    clearCapturedScreenshotMemory(colorCapture);
+
+    screenshot capture = captureScreenshot(bottom, true);
+    QCOMPARE(capture.width, 200u);
+    QCOMPARE(capture.height, 150u);
+    QCOMPARE(capture.bits_per_pixels, 8);
+    cv::Mat image(capture.height, capture.width, CV_8UC1, capture.pixels);
+    QCOMPARE((int) image.at<uchar>(10, 10), (int) expected.at<uchar>(10, 10));
+    clearCapturedScreenshotMemory(capture);
+}
+
+void TestX11Window::findsTheOccludedParts() {
+    QVERIFY(isWindowPartHidden(bottom, 160, 110, 20, 20));
+    QVERIFY(isWindowPartHidden(bottom, 0, 0, 200, 150));
+    QVERIFY(!isWindowPartHidden(bottom, 10, 10, 100, 80));
+    QVERIFY(!isWindowPartHidden(top, 150, 100, 100, 100));
+
+    std::vector<windowRect> above = getWindowsAboveRects(bottom);
+    QCOMPARE(above.size(), (size_t) 1);
+    QCOMPARE(QRect(above[0].x, above[0].y, above[0].width, above[0].height), QRect(150, 100, 100, 100));
+    QVERIFY(getWindowsAboveRects(top).empty());
+}
+
+void TestX11Window::ignoresTheUnmappedWindows() {
+    XUnmapWindow(dpy, top);
+    XSync(dpy, False);
+    refresh();
+
+    QVERIFY(updatedWindows.contains(top));
+    QVERIFY(!updatedWindows.value(top).onScreen);
+    QVERIFY(!isWindowPartHidden(bottom, 160, 110, 20, 20));
+    QCOMPARE(captureScreenshot(top).width, 0u);
+
+    XMapWindow(dpy, top);
+    XSync(dpy, False);
+    refresh();
+    QVERIFY(isWindowPartHidden(bottom, 160, 110, 20, 20));
+}
+
+void TestX11Window::reportsTheClosedWindows() {
+    XDestroyWindow(dpy, top);
+    setClientList({bottom}, bottom);
+    destroyedWindows.clear();
+    refresh();
+
+    QVERIFY(destroyedWindows.contains(top));
+    QVERIFY(!destroyedWindows.contains(bottom));
+    QVERIFY(!updatedWindows.contains(top));
+    QVERIFY(updatedWindows.value(bottom).frontMost);
+    QVERIFY(!isWindowPartHidden(bottom, 0, 0, 200, 150));
+}
+
+// The part outside of the screen cannot be read, it is black so that the capture still covers the whole window
+void TestX11Window::capturesTheWindowsPartlyOffScreen() {
+    Window offScreen = createWindow(-50, 300, 100, 50, 0x00ff00, "Off-screen window");
+    XSync(dpy, False);
+
+    screenshot capture = captureScreenshot(offScreen);
+    QCOMPARE(capture.width, 100u);
+    QCOMPARE(capture.height, 50u);
+    cv::Mat image(capture.height, capture.width, CV_8UC4, capture.pixels);
+    QVERIFY(image.at<cv::Vec4b>(10, 10) == cv::Vec4b(0, 0, 0, 255));
+    QVERIFY(image.at<cv::Vec4b>(10, 70) == cv::Vec4b(0, 255, 0, 255));
+    clearCapturedScreenshotMemory(capture);
+
+    XDestroyWindow(dpy, offScreen);
+    XSync(dpy, False);
+}
+
+void TestX11Window::cleanupTestCase() {
+    if (dpy != NULL) {
+        XCloseDisplay(dpy);
+    }
+}
+
+QTEST_GUILESS_MAIN(TestX11Window)
+#include "tst_x11window.moc"
@@ -0,0 +1,40 @@
+# Tests of the X11 backend, run them with run.sh (they need an X server without window manager)
+
+QT += testlib dbus
+QT -= gui
+
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_x11window
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ../../src/
+
+SOURCES += \
+    tst_x11window.cpp \
+    ../../src/os_specific/screenshotpool.cpp \
+    ../../src/os_specific/linux/window.cpp \
+    ../../src/os_specific/linux/accessibility.cpp \
+    ../../src/os_specific/linux/atspilistener.cpp \
+    ../../src/os_specific/linux/files.cpp
+
+HEADERS += \
+    ../../src/os_specific/window.h \
+    ../../src/os_specific/screenshotpool.h \
+    ../../src/os_specific/linux/accessibility.h \
+    ../../src/os_specific/linux/atspilistener.h \
+    ../../src/os_specific/linux/files.h
+
+LIBS += -lX11 -lXext -lXi -lXdamage
+
+# = Add OpenCV4 to path
+system(pkg-config --exists opencv4) {
+  QMAKE_CXXFLAGS += $$system("pkg-config --cflags opencv4")
+  LIBS += $$system("pkg-config --libs-only-L opencv4")
+}
+
+LIBS += -lopencv_core \
+        -lopencv_imgproc